@@ -0,0 +1,455 @@
+// Offline analyzer for the binary captures of the virtual cable.
+// Rebuilds the link-layer frames of each direction and reports the frame
+// types, retransmissions, inter-frame gaps, ACK latency and efficiency.
+//
+// Usage: analyzer <capture file>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+#define FALSE 0
+#define TRUE 1
+
+// Link-layer frame fields (see src/link_layer.c)
+#define FLAG 0x7E
+#define ESC 0x7D
+#define C_I 0x00
+#define C_II 0x80
+#define C_SET 0x03
+#define C_UA 0x07
+#define C_DISC 0x0B
+#define C_SET_COBS 0x43
+#define C_UA_COBS 0x47
+#define C_PROBE 0x4F
+#define C_PROBE_ECHO 0x53
+#define RR_0 0xAA
+#define RR_1 0xAB
+#define REJ 0x54
+
+#define MAX_FRAME 8192
+#define MAX_BAUD_CHANGES 256
+
+enum FrameType {
+    F_I,
+    F_SET,
+    F_UA,
+    F_DISC,
+    F_RR,
+    F_REJ,
+    F_PROBE,
+    F_OTHER,
+    F_TYPES
+};
+
+const char *frameNames[F_TYPES] = {"I", "SET", "UA", "DISC", "RR", "REJ", "PROBE", "OTHER"};
+
+// Min / mean / max of a series of times, in usec
+struct Stat {
+    unsigned long count;
+    double sum, min, max;
+};
+
+// State of one direction of the cable
+struct Direction {
+    const char *name;
+    unsigned long long bytes, errored, deleted, lost, inserted;
+    unsigned char frame[MAX_FRAME];
+    int len;
+    int overflow;
+    double frameStart;        // Time of the opening FLAG (-1 if none)
+    double lastFrameEnd;      // Time of the last closing FLAG (-1 if none)
+    unsigned long frames[F_TYPES];
+    unsigned long badHeader;  // BCC1 errors or runt frames
+    unsigned long badData;    // I frames with BCC2 or stuffing errors
+    unsigned long retransmissions;
+    int lastNs;               // Sequence number of the last I frame (-1 if none)
+    int delivered;            // The last sequence number got through once
+    unsigned long long payload;
+    double pendingAck;        // End of the last good I frame not yet acknowledged (-1 if none)
+    struct Stat gap;
+    struct Stat ackLatency;   // From the end of an I frame to the end of its RR/REJ
+    // Baud rate changes, to compute the capacity of the line over time
+    double baudTime[MAX_BAUD_CHANGES];
+    unsigned long baudRate[MAX_BAUD_CHANGES];
+    int baudChanges;
+};
+
+struct Direction dirs[2];
+int cobs = FALSE;             // COBS framing negotiated (SET_COBS / UA_COBS)
+
+
+void stat_add(struct Stat *stat, double value)
+{
+    if (stat->count == 0 || value < stat->min)
+    {
+        stat->min = value;
+    }
+    if (stat->count == 0 || value > stat->max)
+    {
+        stat->max = value;
+    }
+    stat->sum += value;
+    stat->count++;
+}
+
+
+void stat_print(const char *label, const struct Stat *stat)
+{
+    if (stat->count == 0)
+    {
+        printf("  %s: none\n", label);
+        return;
+    }
+    printf("  %s (ms, %lu samples): min %.3f, mean %.3f, max %.3f\n", label, stat->count,
+           stat->min / 1000, stat->sum / stat->count / 1000, stat->max / 1000);
+}
+
+
+void add_baud(struct Direction *dir, double time, unsigned long baud)
+{
+    if (dir->baudChanges < MAX_BAUD_CHANGES)
+    {
+        dir->baudTime[dir->baudChanges] = time;
+        dir->baudRate[dir->baudChanges] = baud;
+        dir->baudChanges++;
+    }
+}
+
+
+// Bits a direction of the line could carry between two times (usec), given
+// its baud changes
+double capacity_bits(const struct Direction *dir, double from, double to)
+{
+    double bits = 0;
+    for (int i = 0; i < dir->baudChanges; i++)
+    {
+        double start = dir->baudTime[i] > from ? dir->baudTime[i] : from;
+        double end = (i + 1 < dir->baudChanges && dir->baudTime[i + 1] < to) ? dir->baudTime[i + 1] : to;
+        if (end > start)
+        {
+            bits += (end - start) / 1e6 * dir->baudRate[i];
+        }
+    }
+    return bits;
+}
+
+
+// Remove the byte stuffing (HDLC) or the COBS encoding of a frame body.
+// Returns the number of bytes obtained or -1 if the encoding is invalid.
+int decode_body(const unsigned char *src, int n, unsigned char *dest)
+{
+    int out = 0;
+    if (!cobs)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            if (src[i] == ESC)
+            {
+                if (++i == n)
+                {
+                    return -1;
+                }
+                dest[out++] = src[i] ^ 0x20;
+            }
+            else
+            {
+                dest[out++] = src[i];
+            }
+        }
+        return out;
+    }
+
+    // COBS, with every byte XOR FLAG
+    int in = 0;
+    while (in < n)
+    {
+        unsigned char code = src[in++] ^ FLAG;
+        if (code == 0)
+        {
+            return -1;
+        }
+        for (int i = 1; i < code; i++)
+        {
+            if (in == n)
+            {
+                return -1;
+            }
+            dest[out++] = src[in++] ^ FLAG;
+        }
+        if (code < 0xFF && in < n)
+        {
+            dest[out++] = 0;
+        }
+    }
+    return out;
+}
+
+
+enum FrameType frame_type(unsigned char c)
+{
+    switch (c)
+    {
+        case C_I:
+        case C_II:
+            return F_I;
+        case C_SET:
+        case C_SET_COBS:
+            return F_SET;
+        case C_UA:
+        case C_UA_COBS:
+            return F_UA;
+        case C_DISC:
+            return F_DISC;
+        case RR_0:
+        case RR_1:
+            return F_RR;
+        case REJ:
+            return F_REJ;
+        case C_PROBE:
+        case C_PROBE_ECHO:
+            return F_PROBE;
+        default:
+            return F_OTHER;
+    }
+}
+
+
+// Account for a frame received in direction d, between two FLAGs
+void process_frame(int d, double start, double end)
+{
+    struct Direction *dir = &dirs[d];
+    struct Direction *other = &dirs[1 - d];
+
+    if (dir->lastFrameEnd >= 0 && start >= 0)
+    {
+        stat_add(&dir->gap, start - dir->lastFrameEnd);
+    }
+    dir->lastFrameEnd = end;
+
+    if (dir->len < 3 || dir->overflow || (dir->frame[0] ^ dir->frame[1]) != dir->frame[2])
+    {
+        dir->badHeader++;
+        return;
+    }
+
+    unsigned char c = dir->frame[1];
+    enum FrameType type = frame_type(c);
+    dir->frames[type]++;
+
+    if (c == C_SET || c == C_UA)
+    {
+        cobs = FALSE;
+    }
+    else if (c == C_UA_COBS)
+    {
+        cobs = TRUE;
+    }
+    else if (type == F_RR || type == F_REJ)
+    {
+        // Acknowledges the last I frame sent the other way
+        if (other->pendingAck >= 0)
+        {
+            stat_add(&other->ackLatency, end - other->pendingAck);
+            other->pendingAck = -1;
+        }
+    }
+    else if (type == F_I)
+    {
+        int ns = c == C_II;
+        if (ns == dir->lastNs)
+        {
+            dir->retransmissions++;
+        }
+        else
+        {
+            dir->lastNs = ns;
+            dir->delivered = FALSE;
+        }
+
+        unsigned char body[MAX_FRAME];
+        int n = decode_body(dir->frame + 3, dir->len - 3, body);
+        unsigned char bcc2 = 0;
+        for (int i = 0; i < n; i++)
+        {
+            bcc2 ^= body[i];
+        }
+        if (n < 1 || bcc2 != 0)  // The XOR of the data and BCC2 is 0
+        {
+            dir->badData++;
+            return;
+        }
+        if (!dir->delivered)
+        {
+            dir->payload += n - 1;
+            dir->delivered = TRUE;
+        }
+        dir->pendingAck = end;
+    }
+}
+
+
+// Feed one delivered byte of direction d to the frame reassembly
+void process_byte(int d, unsigned char byte, double time)
+{
+    struct Direction *dir = &dirs[d];
+    if (byte == FLAG)
+    {
+        if (dir->len > 0)
+        {
+            process_frame(d, dir->frameStart, time);
+            dir->len = 0;
+            dir->overflow = FALSE;
+            dir->frameStart = -1;
+        }
+        else
+        {
+            dir->frameStart = time;  // Opening FLAG (or idle FLAGs)
+        }
+        return;
+    }
+    if (dir->len == MAX_FRAME)
+    {
+        dir->overflow = TRUE;
+        return;
+    }
+    dir->frame[dir->len++] = byte;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <capture file>\n", argv[0]);
+        exit(1);
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        exit(-1);
+    }
+
+    struct CaptureHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CAPTURE_VERSION)
+    {
+        printf("%s is not a cable capture (version %d)\n", argv[1], CAPTURE_VERSION);
+        exit(-1);
+    }
+    for (int d = 0; d < 2; d++)
+    {
+        dirs[d].name = d == 0 ? "Tx->Rx" : "Rx->Tx";
+        add_baud(&dirs[d], 0, header.baud[d]);
+        dirs[d].frameStart = -1;
+        dirs[d].lastFrameEnd = -1;
+        dirs[d].lastNs = -1;
+        dirs[d].pendingAck = -1;
+    }
+
+    // Record times are 32 bit usec; unwrap them. The directions have their
+    // own clocks, so times may go back a little between records.
+    double wraps = 0;
+    double latest = 0;
+    double first = -1, last = 0;
+
+    struct CaptureRecord records[4096];
+    size_t n;
+    while ((n = fread(records, sizeof(records[0]), 4096, file)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            const struct CaptureRecord *r = &records[i];
+            // Take the unwrapped time closest to the latest one
+            double time = wraps + r->time;
+            if (time < latest - 2147483648.0)
+            {
+                wraps += 4294967296.0;
+                time += 4294967296.0;
+            }
+            else if (time > latest + 2147483648.0)
+            {
+                time -= 4294967296.0;  // From before the last wrap
+            }
+            if (time > latest)
+            {
+                latest = time;
+            }
+
+            struct Direction *dir = &dirs[r->flags & CAP_RX2TX ? 1 : 0];
+            if (r->flags & CAP_BAUD)
+            {
+                add_baud(dir, time, r->value * 100UL);
+                continue;
+            }
+
+            dir->bytes++;
+            if (r->flags & CAP_DELETED)
+            {
+                dir->deleted++;
+                continue;
+            }
+            if (r->flags & CAP_LOST)
+            {
+                dir->lost++;
+                continue;
+            }
+            if (r->flags & CAP_ERROR)
+            {
+                dir->errored++;
+            }
+            if (r->flags & CAP_INSERTED)
+            {
+                dir->inserted++;
+                dir->bytes--;  // Not sent by the other side
+            }
+            if (first < 0 || time < first)
+            {
+                first = time;
+            }
+            if (time > last)
+            {
+                last = time;
+            }
+            process_byte(r->flags & CAP_RX2TX ? 1 : 0, r->byte, time);
+        }
+    }
+    fclose(file);
+
+    double duration = last - (first < 0 ? 0 : first);
+    printf("Capture %s: %.3f s of traffic\n", argv[1], duration / 1e6);
+
+    for (int d = 0; d < 2; d++)
+    {
+        struct Direction *dir = &dirs[d];
+        double capacity = capacity_bits(dir, first, last);
+        printf("\n%s: baud rate %u", dir->name, header.baud[d]);
+        if (dir->baudChanges > 1)
+        {
+            printf(" (changed %d times)", dir->baudChanges - 1);
+        }
+        printf("\n  %llu bytes sent, %llu with bit errors, %llu deleted, %llu lost in outages, %llu inserted\n",
+               dir->bytes, dir->errored, dir->deleted, dir->lost, dir->inserted);
+        printf("  Frames:");
+        for (int t = 0; t < F_TYPES; t++)
+        {
+            printf(" %s %lu%s", frameNames[t], dir->frames[t], t + 1 < F_TYPES ? "," : "\n");
+        }
+        printf("  Bad frames: %lu header (BCC1 or too short), %lu data (BCC2)\n", dir->badHeader, dir->badData);
+        printf("  Retransmitted I frames: %lu\n", dir->retransmissions);
+        stat_print("Inter-frame gap", &dir->gap);
+        stat_print("ACK latency", &dir->ackLatency);
+        if (capacity > 0)
+        {
+            printf("  I frame data: %llu bytes, efficiency (S) %.3f, line use %.3f\n", dir->payload,
+                   dir->payload * 8 / capacity, dir->bytes * 10 / capacity);
+        }
+    }
+    return 0;
+}
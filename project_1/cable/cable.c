@@ -5,55 +5,105 @@
 // Modified by: Eduardo Nuno Almeida [enalmeida@fe.up.pt]
 // Modified by: Rui Prior [rcprior@fc.up.pt]
 
+#include <errno.h>
 #include <fcntl.h>
-#include <math.h>
+#include <limits.h>
 #include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#define TXDEV "/dev/ttyS10"
-#define RXDEV "/dev/ttyS11"
+#include "capture.h"
+#include "channel.h"
+
+#define FIRST_PORT 10          // Cable n uses /dev/ttyS<10+2n> (Tx) and /dev/ttyS<11+2n> (Rx)
+#define MAX_CABLES 32
+
+// Tags of the epoll events
+#define EVENT_STDIN 0
+#define EVENT_TIMER 1
+#define EVENT_PORT(cable, dir) (2 + 2 * (cable) + (dir))
 // Baudrate settings are defined in <asm/termbits.h>, which is
 // included by <termios.h>
 #define BAUDRATE B9600         // For struct termios
 #define DEFAULT_BAUDRATE 9600  // For the delaying transmissions
+#define MIN_BAUDRATE 1200
+#define MAX_BAUDRATE 4000000   // Fits the capture records (baud / 100 in 16 bits)
 #define _POSIX_SOURCE 1        // POSIX compliant source
 #define FALSE 0
 #define TRUE 1
 
 #define BUF_SIZE 2048
-
-// Current running parameters
-struct Parameters {
-    int cableOn;
-    double byteER;   // Byte error rate
-    struct timespec byteDelay;
-    unsigned long propDelay;   // Desired propagation delay in usec
-    int bufSize;  // Dimensioned to enforce the propagation delay
-    char *tx2rx;
-    char *tx2rxValid;  // TRUE if corresponding entry holds a byte
-    long tx2rxIdx;     // Input index for the tx2rx buffer
-    char *rx2tx;
-    char *rx2txValid;  // TRUE if corresponding entry holds a byte
-    long rx2txIdx;     // Input index for the tx2rx buffer
+#define SLOT_USEC 1000  // Period of the main loop (bytes are moved in batches)
+#define CAPTURE_BUF_SIZE (1 << 20)
+
+// One virtual cable: a pair of ports, with its own running parameters
+struct Cable {
+    int id;
+    char txDev[32];    // Ports opened by the programs under test
+    char rxDev[32];
+    int fdTx;          // Emulator side of the ports
+    int fdRx;
+    struct termios oldtioTx;
+    struct termios oldtioRx;
+    unsigned long long seed;
+    struct Channel ch[2];  // TX2RX and RX2TX (see channel.h)
+    struct timespec nextTick[2];  // Next byte time of each direction
+    int pacing[2];     // Input pulled at the line rate (port out of epoll)
+    int logIdle[2];    // Nothing in or out at the last logged byte time
+    char outPending[2][2 * BUF_SIZE];  // Output the port did not take yet
+    int outLen[2];
+    unsigned long long overrun[2];     // Bytes lost because the port was full
     FILE *logfile;
+    FILE *capture;     // Binary capture (see capture.h)
+    unsigned long long captureStart;  // In nsec, like tickTime
 };
 
-struct Parameters par = {
-    .cableOn = TRUE,
-    .byteER = 0.0,
-    .propDelay = 0,
-    .tx2rx = NULL,
-    .tx2rxValid = NULL,
-    .rx2tx = NULL,
-    .rx2txValid = NULL,
-    .logfile = NULL};
+struct Cable cables[MAX_CABLES];
+int nCables = 1;
+
+// Parse an optional direction argument: "tx" (Tx->Rx), "rx" (Rx->Tx) or
+// none (both). Returns a mask of channels, 0 if invalid.
+int parse_direction(const char *arg)
+{
+    if (arg == NULL || *arg == '\0')
+    {
+        return (1 << TX2RX) | (1 << RX2TX);
+    }
+    if (strcmp(arg, "tx") == 0)
+    {
+        return 1 << TX2RX;
+    }
+    if (strcmp(arg, "rx") == 0)
+    {
+        return 1 << RX2TX;
+    }
+    return 0;
+}
+
+
+const char *direction_name(int mask)
+{
+    switch (mask)
+    {
+        case 1 << TX2RX:
+            return "TX->RX";
+        case 1 << RX2TX:
+            return "RX->TX";
+        default:
+            return "BOTH DIRECTIONS";
+    }
+}
+
 
 // Returns: serial port file descriptor (fd).
 int openSerialPort(const char *serialPort, struct termios *oldtio, struct termios *newtio)
@@ -83,52 +133,76 @@ int openSerialPort(const char *serialPort, struct termios *oldtio, struct termio
 }
 
 
-// Add noise to a buffer, by flipping the byte in the "errorIndex" position.
-void addNoiseToBuffer(unsigned char *buf, size_t errorIndex)
+// Set the propagation delay of one direction (bytes in flight are lost)
+void set_prop_delay(struct Cable *cable, int dir, unsigned long propDelay)
 {
-    buf[errorIndex] ^= 0xFF;
+    unsigned long actualPropDelay = channel_set_prop(&cable->ch[dir], propDelay);
+    printf("PROPAGATION DELAY SET TO %lu usec (DESIRED = %lu usec) (%s)\n", actualPropDelay, propDelay,
+           direction_name(1 << dir));
 }
 
 
-// Initialize the ring buffers that implement the propagation delay
-// Returns 0 on success, -1 on failure
-int init_ring_buffers(void)
+// Append a record to the binary capture, if one is open. time is in nsec,
+// like tickTime; the two directions run on their own clocks, so records are
+// only in time order within each direction.
+void capture_record(struct Cable *cable, unsigned long long time, uint8_t byte, uint8_t flags, uint16_t value)
 {
-    long nsecPropDelay = 1000 * par.propDelay;
-    long bytesInFlight = nsecPropDelay / par.byteDelay.tv_nsec;
-    // Round instead of truncating
-    if (nsecPropDelay % par.byteDelay.tv_nsec > par.byteDelay.tv_nsec / 2)
+    if (cable->capture == NULL)
     {
-        ++bytesInFlight;
+        return;
     }
-    long actualPropDelay = bytesInFlight * par.byteDelay.tv_nsec / 1000; // usec
-    par.bufSize = bytesInFlight + 1;
-    par.tx2rx = realloc(par.tx2rx, par.bufSize);
-    par.tx2rxValid = realloc(par.tx2rxValid, par.bufSize);
-    par.rx2tx = realloc(par.rx2tx, par.bufSize);
-    par.rx2txValid = realloc(par.rx2txValid, par.bufSize);
-    if (par.tx2rx == NULL || par.tx2rxValid == NULL || par.rx2tx == NULL || par.rx2txValid == NULL)
+    if (time < cable->captureStart)
     {
-        return -1;
+        time = cable->captureStart;
+    }
+    struct CaptureRecord record = {
+        .time = (uint32_t) ((time - cable->captureStart) / 1000),
+        .byte = byte,
+        .flags = flags,
+        .value = value};
+    fwrite(&record, sizeof(record), 1, cable->capture);
+}
+
+
+void endcapture(struct Cable *cable)
+{
+    if (cable->capture != NULL)
+    {
+        fclose(cable->capture);
+        cable->capture = NULL;
     }
-    bzero(par.tx2rxValid, par.bufSize);
-    bzero(par.rx2txValid, par.bufSize);
-    par.tx2rxIdx = 0;
-    par.rx2txIdx = 0;
-    printf("PROPAGATION DELAY SET TO %ld usec (DESIRED = %lu usec)\n", actualPropDelay, par.propDelay);
-    return 0;
 }
 
 
-// Set the byte delay corresponding to the selected baud rate
-void set_baud_rate(unsigned long baud)
+// Start a binary capture (see capture.h); records are written through a
+// large stdio buffer to keep the cost per byte low
+void startcapture(struct Cable *cable, const char *filename, const struct timespec *now)
 {
-    // 10 bit times per byte; delay in nanoseconds
-    double delay = 1.0e10 / baud;
-    par.byteDelay.tv_sec = 0;
-    par.byteDelay.tv_nsec = (long) delay;
-    printf("BAUD RATE: %lu\n", baud);
-    init_ring_buffers();
+    endcapture(cable);
+    cable->capture = fopen(filename, "wb");
+    if (cable->capture == NULL)
+    {
+        printf("ERROR OPENING FILE %s, NOT CAPTURING\n", filename);
+        return;
+    }
+    setvbuf(cable->capture, NULL, _IOFBF, CAPTURE_BUF_SIZE);
+    struct CaptureHeader header = { .version = CAPTURE_VERSION,
+                                    .baud = { cable->ch[TX2RX].baud, cable->ch[RX2TX].baud } };
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, cable->capture);
+    cable->captureStart = now->tv_sec * 1000000000ULL + now->tv_nsec;
+    printf("CAPTURING TO FILE %s\n", filename);
+}
+
+
+// Set the byte delay of one direction corresponding to the selected baud rate
+void set_baud_rate(struct Cable *cable, int dir, unsigned long baud, const struct timespec *now)
+{
+    channel_set_baud(&cable->ch[dir], baud);
+    printf("BAUD RATE: %lu (%s)\n", baud, direction_name(1 << dir));
+    capture_record(cable, now->tv_sec * 1000000000ULL + now->tv_nsec, 0, CAP_BAUD | (dir == RX2TX ? CAP_RX2TX : 0),
+                   baud / 100);
+    set_prop_delay(cable, dir, cable->ch[dir].propDelay);
 }
 
 
@@ -197,23 +271,167 @@ int timespec_is_negative(const struct timespec *t)
 }
 
 
-void endlog(void)
+// Restart the error sequences of both directions from the current seed
+void reset_errors(struct Cable *cable)
+{
+    channel_reset_pair(cable->ch, cable->seed);
+}
+
+
+// Append what reaches the other side of one direction to out, and capture
+// the fate of the byte that left the cable
+void deliver_byte(struct Cable *cable, int dir, const struct ChannelEvent *ev, char *out, int *nOut)
+{
+    struct Channel *ch = &cable->ch[dir];
+    uint8_t flags = dir == RX2TX ? CAP_RX2TX : 0;
+    if (ev->status == BYTE_OK)
+    {
+        out[(*nOut)++] = ev->byte;
+        uint8_t errors = ev->byte ^ ev->sent;
+        capture_record(cable, ch->tickTime, ev->byte, flags | (errors != 0 ? CAP_ERROR : 0), errors);
+    }
+    else if (ev->status != BYTE_OFF)
+    {
+        capture_record(cable, ch->tickTime, ev->sent, flags | (ev->status == BYTE_LOST ? CAP_LOST : CAP_DELETED), 0);
+    }
+    if (ev->hasInserted)
+    {
+        out[(*nOut)++] = ev->inserted;
+        capture_record(cable, ch->tickTime, ev->inserted, flags | CAP_INSERTED, 0);
+    }
+}
+
+
+void print_stats(struct Cable *cable)
 {
-    if (par.logfile != NULL)
+    const char *names[2] = {"Tx->Rx", "Rx->Tx"};
+    for (int d = 0; d < 2; ++d)
     {
-        fclose(par.logfile);
-        par.logfile = NULL;
+        struct Channel *ch = &cable->ch[d];
+        printf("%s: %s, %lu baud, %lu usec: %llu bytes, %llu bit errors, %llu deleted, %llu inserted, "
+               "%llu lost in outages, %llu overrun\n", names[d], ch->on ? "on" : "off", ch->baud, ch->propDelay,
+               ch->bytes, ch->bitErrors, ch->deleted, ch->inserted, ch->lostInOutage, cable->overrun[d]);
     }
 }
 
 
-void startlog(const char *filename)
+// Advance one direction of the cable by one of its byte times, at time
+// (nsec). in points to the byte entering the cable (NULL if none); bytes
+// leaving the cable are appended to out.
+void cable_tick(struct Cable *cable, int dir, unsigned long long time, const char *in, char *out, int *nOut)
 {
-    endlog();
-    par.logfile = fopen(filename, "w");
-    if (par.logfile != NULL)
+    struct Channel *ch = &cable->ch[dir];
+    struct ChannelEvent ev;
+    // For logging
+    char logIn[3], logOut[3];
+
+    // Ignore what was read while the direction is off
+    int entered = in != NULL && ch->on;
+    channel_tick(ch, time, in, &ev);
+    if (ev.left)
     {
-        fprintf(par.logfile, "Tx->Rx | Rx->Tx\n");
+        deliver_byte(cable, dir, &ev, out, nOut);
+    }
+
+    if (cable->logfile != NULL)  // Currently logging
+    {
+        if (entered)
+        {
+            sprintf(logIn, "%02hhX", *in);
+        }
+        else
+        {
+            memcpy(logIn, "  ", 3);
+        }
+        if (ev.left)
+        {
+            sprintf(logOut, "%02hhX", ev.byte);
+        }
+        else
+        {
+            memcpy(logOut, "  ", 3);
+        }
+
+        // Each direction logs its own column, at its own byte times
+        if (*logIn == ' ' && *logOut == ' ')
+        {
+            if (!cable->logIdle[dir] && cable->logIdle[1 - dir])
+            {
+                fputs("---------------\n", cable->logfile);
+            }
+            cable->logIdle[dir] = TRUE;
+        }
+        else
+        {
+            fprintf(cable->logfile, dir == TX2RX ? "%s  %s |       \n" : "       | %s  %s\n", logIn, logOut);
+            cable->logIdle[dir] = FALSE;
+        }
+    }
+}
+
+
+// Update the events of the emulator port read by direction dir (and
+// written by the other one): EPOLLIN unless dir is pacing, EPOLLOUT while
+// the other direction has output the port did not take
+void update_port_events(int epfd, struct Cable *cable, int dir)
+{
+    struct epoll_event ev = { .events = (cable->pacing[dir] ? 0 : EPOLLIN) |
+                                        (cable->outLen[1 - dir] > 0 ? EPOLLOUT : 0) };
+    ev.data.u32 = EVENT_PORT(cable->id, dir);
+    epoll_ctl(epfd, EPOLL_CTL_MOD, dir == TX2RX ? cable->fdTx : cable->fdRx, &ev);
+}
+
+
+// Write the output of one direction to its port, after what the port did
+// not take before; what it does not take now waits for EPOLLOUT. Output
+// beyond the pending buffer is lost, like on a receiver that overruns.
+void port_write(struct Cable *cable, int dir, int fd, const char *bytes, int n)
+{
+    int room = (int) sizeof(cable->outPending[dir]) - cable->outLen[dir];
+    if (n > room)
+    {
+        cable->overrun[dir] += n - room;
+        n = room;
+    }
+    memcpy(cable->outPending[dir] + cable->outLen[dir], bytes, n);
+    cable->outLen[dir] += n;
+    if (cable->outLen[dir] == 0)
+    {
+        return;
+    }
+
+    ssize_t written = write(fd, cable->outPending[dir], cable->outLen[dir]);
+    if (written < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        // The port is gone: drop what it will never take
+        cable->overrun[dir] += cable->outLen[dir];
+        cable->outLen[dir] = 0;
+    }
+    else if (written > 0)
+    {
+        cable->outLen[dir] -= written;
+        memmove(cable->outPending[dir], cable->outPending[dir] + written, cable->outLen[dir]);
+    }
+}
+
+
+void endlog(struct Cable *cable)
+{
+    if (cable->logfile != NULL)
+    {
+        fclose(cable->logfile);
+        cable->logfile = NULL;
+    }
+}
+
+
+void startlog(struct Cable *cable, const char *filename)
+{
+    endlog(cable);
+    cable->logfile = fopen(filename, "w");
+    if (cable->logfile != NULL)
+    {
+        fprintf(cable->logfile, "Tx->Rx | Rx->Tx\n");
         printf("LOGGING TO FILE %s\n", filename);
     }
     else
@@ -223,66 +441,628 @@ void startlog(const char *filename)
 }
 
 
+// Set by SIGINT / SIGTERM, to end the program cleanly (closing the capture)
+volatile sig_atomic_t terminate = FALSE;
+
+void on_terminate(int signal)
+{
+    (void) signal;
+    terminate = TRUE;
+}
+
+
+// Timed commands of a scenario; times are in seconds from the first byte
+// that enters the cable
+#define MAX_SCENARIO_STEPS 256
+#define COMMAND_SIZE 128
+
+struct ScenarioStep {
+    double time;
+    char command[COMMAND_SIZE];
+};
+
+struct Scenario {
+    struct ScenarioStep step[MAX_SCENARIO_STEPS];
+    int count;
+    int next;          // Next step to execute
+    int started;
+    struct timespec start;
+} scenario = {
+    .count = 0,
+    .next = 0,
+    .started = FALSE};
+
+
+// Add the steps of a scenario: "t=<sec> <command>" entries separated by ';'
+// or new lines; empty entries and lines starting with '#' are ignored.
+// Returns 0 on success, -1 on failure.
+int scenario_parse(const char *text)
+{
+    while (*text != '\0')
+    {
+        size_t len = strcspn(text, ";\n");
+        const char *end = text + len;
+        while (text < end && (*text == ' ' || *text == '\t' || *text == '\r'))
+        {
+            ++text;
+        }
+        if (text < end && *text != '#')
+        {
+            double time;
+            int offset = 0;
+            if (sscanf(text, "t=%lf %n", &time, &offset) < 1 || offset == 0 || text + offset >= end || time < 0)
+            {
+                printf("BAD SCENARIO STEP: %.*s\n", (int) (end - text), text);
+                return -1;
+            }
+            if (scenario.count == MAX_SCENARIO_STEPS || end - text - offset >= COMMAND_SIZE)
+            {
+                printf("SCENARIO TOO LONG\n");
+                return -1;
+            }
+            // Keep the steps sorted by time, in the given order for equal times
+            int i = scenario.count++;
+            while (i > 0 && scenario.step[i - 1].time > time)
+            {
+                scenario.step[i] = scenario.step[i - 1];
+                --i;
+            }
+            scenario.step[i].time = time;
+            snprintf(scenario.step[i].command, COMMAND_SIZE, "%.*s", (int) (end - text - offset), text + offset);
+            // Drop trailing blanks
+            char *c = scenario.step[i].command + strlen(scenario.step[i].command);
+            while (c > scenario.step[i].command && (c[-1] == ' ' || c[-1] == '\t' || c[-1] == '\r'))
+            {
+                *--c = '\0';
+            }
+        }
+        text = *end != '\0' ? end + 1 : end;
+    }
+    return 0;
+}
+
+
+// Read a scenario file. Returns 0 on success, -1 on failure.
+int scenario_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        printf("ERROR OPENING SCENARIO FILE %s\n", filename);
+        return -1;
+    }
+    char line[BUF_SIZE];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        result = scenario_parse(line);
+    }
+    fclose(file);
+    return result;
+}
+
+
+// Time of the next scenario step, if the scenario is running. Returns FALSE
+// if there is none.
+int scenario_next_time(struct timespec *time)
+{
+    if (!scenario.started || scenario.next == scenario.count)
+    {
+        return FALSE;
+    }
+    long long nsec = (long long) (scenario.step[scenario.next].time * 1e9);
+    struct timespec offset = { .tv_sec = nsec / 1000000000, .tv_nsec = nsec % 1000000000 };
+    *time = timespec_sum(&scenario.start, &offset);
+    return TRUE;
+}
+
+
 // Show help
 void help()
 {
-    printf("\n\n"
-           "Transmitter must open " TXDEV "\n"
-           "Receiver must open " RXDEV "\n"
-           "\n"
+    printf("\n\n");
+    for (int n = 0; n < nCables; ++n)
+    {
+        if (nCables > 1)
+        {
+            printf("Cable %d: ", n);
+        }
+        printf("Transmitter must open /dev/ttyS%d\n", FIRST_PORT + 2 * n);
+        if (nCables > 1)
+        {
+            printf("         ");
+        }
+        printf("Receiver must open /dev/ttyS%d\n", FIRST_PORT + 2 * n + 1);
+    }
+    printf("\n"
            "The cable program is sensible to the following interactive commands:\n"
            "--- help         : show this help\n"
-           "--- on           : connect the cable and data is exchanged (default state)\n"
-           "--- off          : disconnect the cable disabling data to be exchanged\n"
-           "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
-           "--- baud <rate>  : set baud rate, between 1200 and 115200 (default=9600)\n"
+           "--- cable [n|all] [command]\n"
+           "                 : list the cables, select the cable the next commands\n"
+           "                   apply to (default all), or apply one command to a cable\n"
+           "--- on [tx|rx]   : connect the cable and data is exchanged (default state)\n"
+           "--- off [tx|rx]  : disconnect the cable disabling data to be exchanged\n"
+           "--- ber <ber> [tx|rx] : add noise to data bits at a specified BER (default=0)\n"
+           "--- seed <n>     : restart the bit errors from seed n, to repeat a run\n"
+           "--- ge <p> <r> <ber_bad> [tx|rx]\n"
+           "                 : Gilbert-Elliott burst errors: per byte, go from the good\n"
+           "                   to the bad state with probability p and back with r; the\n"
+           "                   BER is ber_bad in the bad state (p = 0 to disable)\n"
+           "--- del <p> [tx|rx] : delete each byte with probability p\n"
+           "--- ins <p> [tx|rx] : insert a random byte after each byte with probability p\n"
+           "--- outage <period> <length> [tx|rx]\n"
+           "                 : cut the line for <length> usec every <period> usec\n"
+           "                   (0 0 to disable)\n"
+           "--- stats        : show the line settings, the bytes carried and the\n"
+           "                   impairments applied\n"
+           "                   [tx|rx] applies to the Tx->Rx or Rx->Tx direction only\n"
+           "                   (default: both)\n"
+           "--- baud <rate> [tx|rx] : set baud rate, any rate between %d and %d\n"
+           "                   (e.g. 115200, 230400, 460800, 921600; default=%d)\n"
            "                   note that 10 bits are sent per byte (8-N-1)\n"
-           "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
+           "--- prop <delay> [tx|rx] : set the propagation delay in usec (0-3600000000,\n"
+           "                   default=0)\n"
            "                   will be approximated to an integer multiple of the byte\n"
            "                   delay (10 / baud_rate)\n"
            "--- log <file>   : log transmitted data to file\n"
            "--- endlog       : stop logging transmitted data\n"
+           "--- capture <file> : capture transmitted data to a binary file, for the\n"
+           "                   analyzer program (faster than log)\n"
+           "--- endcapture   : stop capturing transmitted data\n"
            "--- quit         : terminate the program\n"
            "\n"
            "IMPORTANT: Changing the baud rate or propagation delay while a transmission is\n"
            "           ongoing will result in losses.\n"
-           "\n");
+           "\n", MIN_BAUDRATE, MAX_BAUDRATE, DEFAULT_BAUDRATE);
 }
 
-int main(int argc, char *argv[])
+// Execute a command on one cable. Returns FALSE if the command is unknown.
+int cable_command(struct Cable *cable, const char *cmd, const struct timespec *now)
 {
-    printf("\n");
+    if (strcmp(cmd, "off") == 0 || strncmp(cmd, "off ", 4) == 0 ||
+        strcmp(cmd, "on") == 0 || strncmp(cmd, "on ", 3) == 0)
+    {
+        int on = cmd[1] == 'n';
+        const char *dir = cmd + (on ? 2 : 3);
+        int mask = parse_direction(*dir == ' ' ? dir + 1 : dir);
+        if (mask == 0)
+        {
+            printf("BAD DIRECTION (MUST BE tx OR rx)\n");
+            return TRUE;
+        }
+        printf("CONNECTION %s (%s)\n", on ? "ON" : "OFF", direction_name(mask));
+        for (int d = 0; d < 2; ++d)
+        {
+            if (mask & (1 << d))
+            {
+                if (!on && cable->ch[d].on && cable->logfile != NULL)
+                {
+                    fprintf(cable->logfile, "CABLE OFF (%s)\n", direction_name(1 << d));
+                }
+                cable->ch[d].on = on;
+            }
+        }
+    }
+    else if (strncmp(cmd, "ber ", 4) == 0)
+    {
+        double ber;
+        char dir[8] = "";
+        int mask = 0;
+        if (sscanf(cmd + 4, "%lf %7s", &ber, dir) >= 1)
+        {
+            mask = parse_direction(dir);
+        }
+        if (mask != 0 && ber >= 0.0 && ber < 1.0)
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                if (mask & (1 << d))
+                {
+                    channel_set_ber(&cable->ch[d], ber);
+                }
+            }
+            printf("BER SET TO %lf (%s)\n", ber, direction_name(mask));
+        }
+        else
+        {
+            printf("BAD BER VALUE (MUST BE 0 <= BER < 1.0)\n");
+        }
+    }
+    else if (strncmp(cmd, "ge ", 3) == 0)
+    {
+        double p, r, berBad;
+        char dir[8] = "";
+        int mask = 0;
+        if (sscanf(cmd + 3, "%lf %lf %lf %7s", &p, &r, &berBad, dir) >= 3)
+        {
+            mask = parse_direction(dir);
+        }
+        if (mask != 0 && p >= 0.0 && p < 1.0 && r >= 0.0 && r < 1.0 && berBad >= 0.0 && berBad < 1.0)
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                if (mask & (1 << d))
+                {
+                    channel_set_ge(&cable->ch[d], p, r, berBad);
+                }
+            }
+            printf("GILBERT-ELLIOTT SET TO P(GOOD->BAD)=%lf P(BAD->GOOD)=%lf BAD STATE BER=%lf (%s)\n",
+                   p, r, berBad, direction_name(mask));
+        }
+        else
+        {
+            printf("BAD GILBERT-ELLIOTT PARAMETERS (MUST BE 0 <= VALUE < 1.0)\n");
+        }
+    }
+    else if (strncmp(cmd, "del ", 4) == 0 || strncmp(cmd, "ins ", 4) == 0)
+    {
+        int deletion = cmd[0] == 'd';
+        double prob;
+        char dir[8] = "";
+        int mask = 0;
+        if (sscanf(cmd + 4, "%lf %7s", &prob, dir) >= 1)
+        {
+            mask = parse_direction(dir);
+        }
+        if (mask != 0 && prob >= 0.0 && prob < 1.0)
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                if (mask & (1 << d))
+                {
+                    if (deletion)
+                    {
+                        channel_set_deletion(&cable->ch[d], prob);
+                    }
+                    else
+                    {
+                        channel_set_insertion(&cable->ch[d], prob);
+                    }
+                }
+            }
+            printf("%s PROBABILITY SET TO %lf (%s)\n", deletion ? "DELETION" : "INSERTION",
+                   prob, direction_name(mask));
+        }
+        else
+        {
+            printf("BAD PROBABILITY (MUST BE 0 <= PROBABILITY < 1.0)\n");
+        }
+    }
+    else if (strncmp(cmd, "outage ", 7) == 0)
+    {
+        unsigned long period, length;
+        char dir[8] = "";
+        int mask = 0;
+        if (sscanf(cmd + 7, "%lu %lu %7s", &period, &length, dir) >= 2)
+        {
+            mask = parse_direction(dir);
+        }
+        if (mask != 0 && length <= period)
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                if (mask & (1 << d))
+                {
+                    channel_set_outage(&cable->ch[d], period, length, now->tv_sec * 1000000000ULL + now->tv_nsec);
+                }
+            }
+            printf("OUTAGES SET TO %lu usec EVERY %lu usec (%s)\n", length, period, direction_name(mask));
+        }
+        else
+        {
+            printf("BAD OUTAGE PARAMETERS (LENGTH MUST NOT EXCEED PERIOD)\n");
+        }
+    }
+    else if (strcmp(cmd, "stats") == 0)
+    {
+        print_stats(cable);
+    }
+    else if (strncmp(cmd, "seed ", 5) == 0)
+    {
+        unsigned long long seed;
+        if (sscanf(cmd + 5, "%llu", &seed) == 1)
+        {
+            cable->seed = seed;
+            reset_errors(cable);
+            printf("SEED SET TO %llu\n", cable->seed);
+        }
+        else
+        {
+            printf("BAD SEED VALUE\n");
+        }
+    }
+    else if (strncmp(cmd, "baud ", 5) == 0)
+    {
+        unsigned long baud = 0;
+        char dir[8] = "";
+        int mask = 0;
+        if (sscanf(cmd + 5, "%lu %7s", &baud, dir) >= 1)
+        {
+            mask = parse_direction(dir);
+        }
+        // Any rate: the lines are paced by the byte delay, not by termios
+        if (mask != 0 && baud >= MIN_BAUDRATE && baud <= MAX_BAUDRATE)
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                if (mask & (1 << d))
+                {
+                    set_baud_rate(cable, d, baud, now);
+                }
+            }
+        }
+        else
+        {
+            printf("UNSUPPORTED BAUD RATE: must be between %d and %d\n", MIN_BAUDRATE, MAX_BAUDRATE);
+        }
+    }
+    else if (strncmp(cmd, "prop ", 5) == 0)
+    {
+        unsigned long propDelay;
+        char dir[8] = "";
+        int mask = 0;
+        if (sscanf(cmd + 5, "%lu %7s", &propDelay, dir) >= 1)
+        {
+            mask = parse_direction(dir);
+        }
+        if (mask == 0 || propDelay > MAX_PROP_DELAY)
+        {
+            printf("BAD OR OUT OF RANGE PROPAGATION DELAY\n");
+        }
+        else
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                if (mask & (1 << d))
+                {
+                    set_prop_delay(cable, d, propDelay);
+                }
+            }
+        }
+    }
+    else if (strncmp(cmd, "log ", 4) == 0)
+    {
+        startlog(cable, cmd + 4);
+    }
+    else if (strcmp(cmd, "endlog") == 0)
+    {
+        endlog(cable);
+        printf("NOT LOGGING\n");
+    }
+    else if (strncmp(cmd, "capture ", 8) == 0)
+    {
+        startcapture(cable, cmd + 8, now);
+    }
+    else if (strcmp(cmd, "endcapture") == 0)
+    {
+        endcapture(cable);
+        printf("NOT CAPTURING\n");
+    }
+    else
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
 
-    system("socat -dd PTY,link=" TXDEV ",mode=777,raw,echo=0 PTY,link=/dev/emulatorTx,mode=777,raw,echo=0 &");
-    sleep(1);
-    printf("\n");
 
-    system("socat -dd PTY,link=" RXDEV ",mode=777,raw,echo=0 PTY,link=/dev/emulatorRx,mode=777,raw,echo=0 &");
-    sleep(1);
+// Cable the console commands apply to (-1 for all)
+int selectedCable = -1;
 
-    help();
+// Execute a console or scenario command on the selected cables, or on the
+// ones given by a "cable <n|all> <command>" prefix. Returns TRUE to end the
+// program.
+int console_command(const char *cmd, const struct timespec *now)
+{
+    if (strcmp(cmd, "quit") == 0)
+    {
+        printf("END OF THE PROGRAM\n");
+        return TRUE;
+    }
+    if (strcmp(cmd, "help") == 0)
+    {
+        help();
+        return FALSE;
+    }
 
-    // Configure serial ports
-    struct termios oldtioTx;
-    struct termios newtioTx;
+    int target = selectedCable;
+    if (strcmp(cmd, "cable") == 0)
+    {
+        for (int n = 0; n < nCables; ++n)
+        {
+            printf("CABLE %d: %s <-> %s%s\n", n, cables[n].txDev, cables[n].rxDev,
+                   selectedCable == -1 || selectedCable == n ? " (selected)" : "");
+        }
+        return FALSE;
+    }
+    if (strncmp(cmd, "cable ", 6) == 0)
+    {
+        int offset = 0;
+        if (strncmp(cmd + 6, "all", 3) == 0 && (cmd[9] == '\0' || cmd[9] == ' '))
+        {
+            target = -1;
+            offset = 3;
+        }
+        else if (sscanf(cmd + 6, "%d%n", &target, &offset) < 1 || target < 0 || target >= nCables)
+        {
+            printf("BAD CABLE NUMBER (MUST BE 0 TO %d OR all)\n", nCables - 1);
+            return FALSE;
+        }
+        cmd += 6 + offset;
+        if (*cmd == '\0')
+        {
+            selectedCable = target;
+            if (target == -1)
+            {
+                printf("COMMANDS APPLY TO ALL CABLES\n");
+            }
+            else
+            {
+                printf("COMMANDS APPLY TO CABLE %d\n", target);
+            }
+            return FALSE;
+        }
+        while (*cmd == ' ')
+        {
+            ++cmd;
+        }
+    }
 
-    int fdTx = openSerialPort("/dev/emulatorTx", &oldtioTx, &newtioTx);
+    for (int n = target == -1 ? 0 : target; n < (target == -1 ? nCables : target + 1); ++n)
+    {
+        char command[BUF_SIZE + 8];
+        snprintf(command, sizeof(command), "%s", cmd);
+        if (nCables > 1)
+        {
+            printf("CABLE %d: ", n);
+            // One log or capture file per cable
+            if (target == -1 && (strncmp(cmd, "log ", 4) == 0 || strncmp(cmd, "capture ", 8) == 0))
+            {
+                snprintf(command, sizeof(command), "%s.%d", cmd, n);
+            }
+        }
+        // One seed for all cables: cable n takes seed + n, so that the cables
+        // are not correlated; a seed for one cable is used as given
+        unsigned long long seed;
+        if (target == -1 && sscanf(cmd, "seed %llu", &seed) == 1)
+        {
+            snprintf(command, sizeof(command), "seed %llu", seed + n);
+        }
+        if (!cable_command(&cables[n], command, now))
+        {
+            printf("BAD COMMAND OR MISSING PARAMETERS\n");
+            break;
+        }
+    }
+    return FALSE;
+}
+
+
+// Show the command line options
+void usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  -n <cables>  number of cables (default 1); cable n connects\n"
+           "               /dev/ttyS<10+2n> (Tx) and /dev/ttyS<11+2n> (Rx)\n"
+           "  -b <rate>    initial baud rate (1200 to 4000000, e.g. 921600)\n"
+           "  -p <delay>   initial propagation delay in usec\n"
+           "  -e <ber>     initial bit error rate\n"
+           "  -s <n>       seed of the random impairments\n"
+           "  -l <file>    log transmitted data to file\n"
+           "  -w <file>    capture transmitted data to a binary file\n"
+           "  -f <file>    run the scenario in file\n"
+           "  -c <steps>   run the given scenario steps\n"
+           "  -h           show this help\n"
+           "\n"
+           "A scenario is a list of timed console commands, \"t=<sec> <command>\",\n"
+           "separated by ';' or new lines (lines starting with '#' are comments).\n"
+           "Times count from the first byte that enters the cable. Example:\n"
+           "  %s -b 38400 -s 1 -c \"t=2.0 ber 1e-4; t=5.0 off; t=6.5 on; t=30 quit\"\n",
+           program, program);
+}
 
-    if (fdTx < 0)
+
+int main(int argc, char *argv[])
+{
+    // Initial parameters (applied as console commands) and scenario
+    const char *initial[][2] = {{"baud", NULL}, {"prop", NULL}, {"ber", NULL}, {"seed", NULL}, {"log", NULL},
+                                {"capture", NULL}};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:p:e:s:l:w:f:c:h")) != -1)
     {
-        perror("Opening Tx emulator serial port");
-        exit(-1);
+        switch (opt)
+        {
+            case 'n':
+                nCables = atoi(optarg);
+                if (nCables < 1 || nCables > MAX_CABLES)
+                {
+                    printf("THE NUMBER OF CABLES MUST BE 1 TO %d\n", MAX_CABLES);
+                    exit(-1);
+                }
+                break;
+            case 'b':
+                initial[0][1] = optarg;
+                break;
+            case 'p':
+                initial[1][1] = optarg;
+                break;
+            case 'e':
+                initial[2][1] = optarg;
+                break;
+            case 's':
+                initial[3][1] = optarg;
+                break;
+            case 'l':
+                initial[4][1] = optarg;
+                break;
+            case 'w':
+                initial[5][1] = optarg;
+                break;
+            case 'f':
+                if (scenario_load(optarg) != 0)
+                {
+                    exit(-1);
+                }
+                break;
+            case 'c':
+                if (scenario_parse(optarg) != 0)
+                {
+                    exit(-1);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? 0 : -1);
+        }
     }
 
-    struct termios oldtioRx;
-    struct termios newtioRx;
+    // Output may go to a file in scripted runs
+    setvbuf(stdout, NULL, _IOLBF, 0);
 
-    int fdRx = openSerialPort("/dev/emulatorRx", &oldtioRx, &newtioRx);
+    printf("\n");
 
-    if (fdRx < 0)
+    // Create the pairs of virtual ports of every cable
+    for (int n = 0; n < nCables; ++n)
     {
-        perror("Opening Rx emulator serial port");
-        exit(-1);
+        struct Cable *cable = &cables[n];
+        cable->id = n;
+        snprintf(cable->txDev, sizeof(cable->txDev), "/dev/ttyS%d", FIRST_PORT + 2 * n);
+        snprintf(cable->rxDev, sizeof(cable->rxDev), "/dev/ttyS%d", FIRST_PORT + 2 * n + 1);
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "socat -dd PTY,link=%s,mode=777,raw,echo=0 PTY,link=/dev/emulatorTx%d,mode=777,raw,echo=0 &",
+                 cable->txDev, n);
+        system(cmd);
+        snprintf(cmd, sizeof(cmd), "socat -dd PTY,link=%s,mode=777,raw,echo=0 PTY,link=/dev/emulatorRx%d,mode=777,raw,echo=0 &",
+                 cable->rxDev, n);
+        system(cmd);
+    }
+    sleep(1);
+    printf("\n");
+
+    help();
+
+    // Configure serial ports
+    for (int n = 0; n < nCables; ++n)
+    {
+        struct Cable *cable = &cables[n];
+        struct termios newtio;
+        char port[32];
+
+        snprintf(port, sizeof(port), "/dev/emulatorTx%d", n);
+        cable->fdTx = openSerialPort(port, &cable->oldtioTx, &newtio);
+        if (cable->fdTx < 0)
+        {
+            perror("Opening Tx emulator serial port");
+            exit(-1);
+        }
+
+        snprintf(port, sizeof(port), "/dev/emulatorRx%d", n);
+        cable->fdRx = openSerialPort(port, &cable->oldtioRx, &newtio);
+        if (cable->fdRx < 0)
+        {
+            perror("Opening Rx emulator serial port");
+            exit(-1);
+        }
     }
 
     // Configure stdin to receive commands to this program
@@ -293,264 +1073,347 @@ int main(int argc, char *argv[])
 
     int STOP = FALSE;
 
-    set_baud_rate(DEFAULT_BAUDRATE);
+    // SIGINT / SIGTERM are only let in while waiting in epoll_pwait, so one
+    // arriving while the loop runs ends the next wait instead of being missed
+    struct sigaction action = { .sa_handler = on_terminate };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigset_t terminateSignals, waitMask;
+    sigemptyset(&terminateSignals);
+    sigaddset(&terminateSignals, SIGINT);
+    sigaddset(&terminateSignals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &terminateSignals, &waitMask);
+
+    // Cable n starts from seed + n, so that the cables are not correlated
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    unsigned long long seed = time(NULL);
+    for (int n = 0; n < nCables; ++n)
+    {
+        struct Cable *cable = &cables[n];
+        channel_init(&cable->ch[TX2RX], DEFAULT_BAUDRATE);
+        channel_init(&cable->ch[RX2TX], DEFAULT_BAUDRATE);
+        if (nCables > 1)
+        {
+            printf("CABLE %d: %s <-> %s\n", n, cable->txDev, cable->rxDev);
+        }
+        set_baud_rate(cable, TX2RX, DEFAULT_BAUDRATE, &startTime);
+        set_baud_rate(cable, RX2TX, DEFAULT_BAUDRATE, &startTime);
+        cable->seed = seed + n;
+    }
+    printf("SEED: %llu\n", seed);
 
-    set_rt_priority();
+    for (size_t i = 0; i < sizeof(initial) / sizeof(initial[0]); ++i)
+    {
+        if (initial[i][1] != NULL)
+        {
+            char cmd[COMMAND_SIZE];
+            snprintf(cmd, sizeof(cmd), "%s %s", initial[i][0], initial[i][1]);
+            console_command(cmd, &startTime);
+        }
+    }
+    // The error sequences start from the seed with the initial settings, as
+    // in the simulator (simlink.h)
+    for (int n = 0; n < nCables; ++n)
+    {
+        reset_errors(&cables[n]);
+    }
+    if (scenario.count > 0)
+    {
+        printf("SCENARIO OF %d STEPS, STARTING WITH THE FIRST BYTE\n", scenario.count);
+    }
 
-    // For logging
-    char tx2rxTx[3], tx2rxRx[3], rx2txTx[3], rx2txRx[3];
-    int cableIdle = FALSE;
+    set_rt_priority();
 
     printf("\nCable ready\n\n");
 
-    // To compensate for deviations in byte transmission time
-    struct timespec currentTime, nextTxTime, timeDiff, nextWait;
-    int skipWait = FALSE;
-    int unreliableRate = FALSE;
-    clock_gettime(CLOCK_MONOTONIC, &nextTxTime);
-
-    while (STOP == FALSE)
+    // Bytes read from and written to an emulator port in one slot (up to two
+    // bytes leave the cable per byte time, with insertions)
+    char fromPort[BUF_SIZE], toPort[2 * BUF_SIZE];
+
+    // Event loop: stdin, the emulator ports of all cables and a timer for the
+    // next slot or delivery deadline. While a direction is "pacing", its
+    // input is pulled at its line rate on every slot and its port is left
+    // out of epoll; otherwise the port wakes the loop as soon as a byte
+    // arrives. With no bytes in flight and nothing to read the timer is
+    // disarmed and the cable sleeps.
+    int epfd = epoll_create1(0);
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (epfd < 0 || timerFd < 0)
     {
-        // Check how much waiting time we should have (if any)
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        timeDiff = timespec_diff(&currentTime, &nextTxTime);
-        nextTxTime = timespec_sum(&nextTxTime, &par.byteDelay);
-        if (timeDiff.tv_sec >= 1)
-        {
-            if (unreliableRate == FALSE)
-            {
-                printf("UNRELIABLE RATE: Could not keep up, timeDiff exceeded 1s\n"
-                       "No further warnings will be issued\n");
-                unreliableRate = TRUE;
-            }
-        }
-        nextWait = timespec_diff(&nextTxTime, &currentTime);
-        if (timespec_is_negative(&nextWait))
+        perror("epoll/timerfd");
+        exit(-1);
+    }
+    // A regular file (or /dev/null) cannot be watched and is always
+    // readable: it is read on every pass until its end
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.u32 = EVENT_STDIN;
+    int stdinPolled = FALSE;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1)
+    {
+        if (errno != EPERM)
         {
-            skipWait = TRUE;
+            perror("epoll_ctl(stdin)");
+            exit(-1);
         }
-        else
+        stdinPolled = TRUE;
+    }
+    ev.data.u32 = EVENT_TIMER;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev);
+    for (int n = 0; n < nCables; ++n)
+    {
+        ev.data.u32 = EVENT_PORT(n, TX2RX);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, cables[n].fdTx, &ev);
+        ev.data.u32 = EVENT_PORT(n, RX2TX);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, cables[n].fdRx, &ev);
+    }
+
+    // Each direction has its own line clock: bytes are moved in batches, one
+    // byte per byte time elapsed since the previous wake (nextTick[d] is the
+    // next byte time). TX2RX reads fdTx and writes fdRx; RX2TX the opposite.
+    struct timespec currentTime, nextWake, lag;
+    struct timespec slot = { .tv_sec = 0, .tv_nsec = SLOT_USEC * 1000 };
+    int unreliableRate = FALSE;
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    for (int n = 0; n < nCables; ++n)
+    {
+        for (int d = 0; d < 2; ++d)
         {
-            skipWait = FALSE;
+            cables[n].nextTick[d] = currentTime;
+            cables[n].pacing[d] = FALSE;
         }
+    }
 
-        // Read from Tx
-        int bytesFromTx = read(fdTx, par.tx2rx + par.tx2rxIdx, 1);
-        par.tx2rxValid[par.tx2rxIdx] = bytesFromTx > 0;
-
-        // Read from Rx
-        int bytesFromRx = read(fdRx, par.rx2tx + par.rx2txIdx, 1);
-        par.rx2txValid[par.rx2txIdx] = bytesFromRx > 0;
-
-        if (!par.cableOn)
+    while (STOP == FALSE)
+    {
+        struct epoll_event events[2 * MAX_CABLES + 2];
+        int nEvents = epoll_pwait(epfd, events, 2 * MAX_CABLES + 2, stdinPolled ? 0 : -1, &waitMask);
+        if (terminate)
         {
-            // Ignore what was read
-            par.tx2rxValid[par.tx2rxIdx] = 0;
-            par.rx2txValid[par.rx2txIdx] = 0;
+            printf("END OF THE PROGRAM\n");
+            break;
         }
-
-        if (par.logfile != NULL)  // Currently logging
+        int portReady[MAX_CABLES][2] = {{FALSE}};
+        int anyPortReady = FALSE;
+        int stdinReady = stdinPolled;
+        for (int i = 0; i < nEvents; ++i)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            if (events[i].data.u32 == EVENT_STDIN)
             {
-                sprintf(tx2rxTx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
+                stdinReady = TRUE;
             }
-            else
+            else if (events[i].data.u32 == EVENT_TIMER)
             {
-                memcpy(tx2rxTx, "  ", 3);
+                uint64_t expirations;
+                read(timerFd, &expirations, sizeof(expirations));
             }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txTx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
+            else if (events[i].events & ~EPOLLOUT)
             {
-                memcpy(rx2txTx, "  ", 3);
+                // EPOLLOUT alone only lets the pending output through
+                uint32_t port = events[i].data.u32 - EVENT_PORT(0, 0);
+                portReady[port / 2][port % 2] = TRUE;
+                anyPortReady = TRUE;
             }
         }
 
-        // Advance indices to next position
-        par.tx2rxIdx = (par.tx2rxIdx + 1) % par.bufSize;
-        par.rx2txIdx = (par.rx2txIdx + 1) % par.bufSize;
+        clock_gettime(CLOCK_MONOTONIC, &currentTime);
+
+        // The scenario clock starts with the first byte
+        if (anyPortReady && !scenario.started && scenario.count > 0)
+        {
+            scenario.started = TRUE;
+            scenario.start = currentTime;
+            printf("SCENARIO STARTED\n");
+        }
+        struct timespec stepTime;
+        while (STOP == FALSE && scenario_next_time(&stepTime) && timespec_comp(&stepTime, &currentTime) <= 0)
+        {
+            struct ScenarioStep *step = &scenario.step[scenario.next++];
+            printf("[t=%.3f] %s\n", step->time, step->command);
+            STOP = console_command(step->command, &currentTime);
+        }
 
-        if (par.cableOn)
+        for (int n = 0; n < nCables; ++n)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            struct Cable *cable = &cables[n];
+            int fdIn[2] = {cable->fdTx, cable->fdRx};
+            int fdOut[2] = {cable->fdRx, cable->fdTx};
+            for (int d = 0; d < 2; ++d)
             {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
+                struct Channel *ch = &cable->ch[d];
+                if (!cable->pacing[d] && ch->inFlight == 0 && timespec_comp(&cable->nextTick[d], &currentTime) < 0)
                 {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.tx2rx[par.tx2rxIdx] ^= (char) 1 << rand() % 8;
+                    // The line was idle: no byte times to catch up on
+                    cable->nextTick[d] = currentTime;
+                }
+                else if (!cable->pacing[d] && timespec_comp(&cable->nextTick[d], &currentTime) < 0)
+                {
+                    // Nothing enters the cable: skip the byte times before
+                    // the next delivery at once, however long the delay
+                    struct timespec elapsed = timespec_diff(&currentTime, &cable->nextTick[d]);
+                    long long skip = (elapsed.tv_sec * 1000000000LL + elapsed.tv_nsec) / ch->byteDelay.tv_nsec;
+                    if (skip > channel_ticks_to_delivery(ch))
+                    {
+                        skip = channel_ticks_to_delivery(ch);
+                    }
+                    long long nsec = skip * ch->byteDelay.tv_nsec;
+                    struct timespec skipped = { .tv_sec = nsec / 1000000000, .tv_nsec = nsec % 1000000000 };
+                    cable->nextTick[d] = timespec_sum(&cable->nextTick[d], &skipped);
+                    ch->tick += skip;
                 }
-                write(fdRx, par.tx2rx + par.tx2rxIdx, 1);
-            }
 
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
+                // Count the byte times that are due
+                struct timespec tickTime = cable->nextTick[d];
+                int ticks = 0;
+                while (ticks < BUF_SIZE && timespec_comp(&cable->nextTick[d], &currentTime) <= 0)
                 {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.rx2tx[par.rx2txIdx] ^= (char) 1 << rand() % 8;
+                    cable->nextTick[d] = timespec_sum(&cable->nextTick[d], &ch->byteDelay);
+                    ++ticks;
+                }
+                lag = timespec_diff(&currentTime, &cable->nextTick[d]);
+                if (lag.tv_sec >= 1)
+                {
+                    if (unreliableRate == FALSE)
+                    {
+                        printf("UNRELIABLE RATE: Could not keep up, timeDiff exceeded 1s\n"
+                               "No further warnings will be issued\n");
+                        unreliableRate = TRUE;
+                    }
                 }
-                write(fdTx, par.rx2tx + par.rx2txIdx, 1);
-            }
-        }
 
-        if (par.logfile != NULL)  // Currently logging
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                sprintf(tx2rxRx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
-            }
-            else
-            {
-                memcpy(tx2rxRx, "  ", 3);
-            }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txRx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
-            {
-                memcpy(rx2txRx, "  ", 3);
-            }
+                // At most one byte per byte time enters the cable. Bytes that
+                // woke the loop enter from the next byte time on.
+                int bytesIn = 0;
+                if (cable->pacing[d] && ticks > 0)
+                {
+                    bytesIn = read(fdIn[d], fromPort, ticks);
+                }
 
-            if (*tx2rxTx == ' ' && *rx2txTx == ' ' && *tx2rxRx == ' ' && *rx2txRx == ' ')
-            {
-                if (cableIdle == FALSE)
+                int bytesOut = 0;
+                for (int i = 0; i < ticks; ++i)
                 {
-                    fputs("---------------\n", par.logfile);
-                    cableIdle = TRUE;
+                    cable_tick(cable, d, tickTime.tv_sec * 1000000000ULL + tickTime.tv_nsec,
+                               i < bytesIn ? fromPort + i : NULL, toPort, &bytesOut);
+                    tickTime = timespec_sum(&tickTime, &ch->byteDelay);
+                }
+                int blocked = cable->outLen[d] > 0;
+                if (bytesOut > 0 || blocked)
+                {
+                    port_write(cable, d, fdOut[d], toPort, bytesOut);
+                }
+                if (blocked != (cable->outLen[d] > 0))
+                {
+                    update_port_events(epfd, cable, 1 - d);
+                }
+
+                // Port drained: wait for it in epoll again
+                if (cable->pacing[d] && bytesIn < ticks)
+                {
+                    cable->pacing[d] = FALSE;
+                    update_port_events(epfd, cable, d);
+                }
+                else if (!cable->pacing[d] && portReady[n][d])
+                {
+                    cable->pacing[d] = TRUE;
+                    update_port_events(epfd, cable, d);
                 }
-            }
-            else
-            {
-                fprintf(par.logfile, "%s  %s | %s  %s\n", tx2rxTx, tx2rxRx, rx2txTx, rx2txRx);
-                cableIdle = FALSE;
             }
         }
 
-        // Read commands from STDIN to control the cable mode
-        int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE);
+        // Read commands from STDIN to control the cable mode, one per line
+        int fromStdin = stdinReady ? read(STDIN_FILENO, rxStdin, BUF_SIZE - 1) : 0;
         if (fromStdin > 0)
         {
-            rxStdin[fromStdin - 1] = '\0';
-
-            if (strcmp(rxStdin, "off") == 0)
-            {
-                printf("CONNECTION OFF\n");
-                if (par.cableOn && par.logfile != NULL)
-                {
-                    fputs("CABLE OFF\n", par.logfile);
-                }
-                par.cableOn = FALSE;
-            }
-            else if (strcmp(rxStdin, "on") == 0)
+            rxStdin[fromStdin] = '\0';
+            for (char *cmd = strtok(rxStdin, "\n"); cmd != NULL && !STOP; cmd = strtok(NULL, "\n"))
             {
-                printf("CONNECTION ON\n");
-                par.cableOn = TRUE;
+                STOP = console_command(cmd, &currentTime);
             }
-            else if (strncmp(rxStdin, "ber ", 4) == 0)
+        }
+        else if (fromStdin == 0 && stdinPolled)
+        {
+            stdinPolled = FALSE;
+        }
+        else if (fromStdin == 0 && stdinReady)
+        {
+            // End of input: stop watching stdin
+            epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        }
+
+        // Schedule the next wake, the earliest over all directions: the next
+        // slot while pacing (or the next byte time, if later; now if the
+        // batch was cut short by BUF_SIZE), otherwise the next delivery of a
+        // byte in flight, if any
+        struct itimerspec timer = { 0 };
+        int timerSet = FALSE;
+        for (int n = 0; n < nCables; ++n)
+        {
+            struct Cable *cable = &cables[n];
+            for (int d = 0; d < 2; ++d)
             {
-                double ber;
-                sscanf(rxStdin + 4, "%lf", &ber);
-                // Compute pow(1 - ber, 8) without libm
-                double acc = 1 - ber;
-                acc *= acc;   // Squared
-                acc *= acc;   // To the fourth
-                acc *= acc;   // To the eightth
-                par.byteER = 1.0 - acc;
-                //printf("Byte Error Rate is %lf\n", par.byteER);
-                if (ber >= 0.0 && ber < 1.0)
+                struct Channel *ch = &cable->ch[d];
+                if (cable->pacing[d])
                 {
-                    printf("BER SET TO %lf\n", ber);
-                    if (ber > 0.01)
+                    nextWake = timespec_sum(&currentTime, &slot);
+                    if (timespec_comp(&cable->nextTick[d], &nextWake) > 0)
                     {
-                        printf("   ACTUAL BER WILL BE LOWER THAN DEFINED FOR VALUES ABOVE 0.01\n");
+                        nextWake = cable->nextTick[d];
+                    }
+                    if (timespec_comp(&cable->nextTick[d], &currentTime) <= 0)
+                    {
+                        nextWake = currentTime;
                     }
                 }
-                else
+                else if (ch->inFlight > 0)
                 {
-                    printf("BAD BER VALUE %lf (MUST BE 0 <= BER < 1.0)", ber);
+                    long long nsec = channel_ticks_to_delivery(ch) * ch->byteDelay.tv_nsec;
+                    struct timespec untilDelivery = { .tv_sec = nsec / 1000000000,
+                                                      .tv_nsec = nsec % 1000000000 };
+                    nextWake = timespec_sum(&cable->nextTick[d], &untilDelivery);
                 }
-            }
-            else if (strncmp(rxStdin, "baud ", 5) == 0)
-            {
-                unsigned long baud = 0;
-                sscanf(rxStdin + 5, "%lu", &baud);
-                switch (baud) {
-                    case 1200:
-                    case 1800:
-                    case 2400:
-                    case 4800:
-                    case 9600:
-                    case 19200:
-                    case 38400:
-                    case 57600:
-                    case 115200:
-                        set_baud_rate(baud);
-                        break;
-                    default:
-                        printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
-                }
-            }
-            else if (strncmp(rxStdin, "prop ", 5) == 0)
-            {
-                unsigned long propDelay;
-                if (sscanf(rxStdin + 5, "%lu", &propDelay) < 1 || propDelay > 1000000)
+                else
                 {
-                    printf("BAD OR OUT OF RANGE PROPAGATION DELAY\n");
+                    continue;
                 }
-                else
+                if (!timerSet || timespec_comp(&nextWake, &timer.it_value) < 0)
                 {
-                    par.propDelay = propDelay;
-                    init_ring_buffers();
+                    timer.it_value = nextWake;
+                    timerSet = TRUE;
                 }
             }
-            else if (strncmp(rxStdin, "log ", 4) == 0)
-            {
-                startlog(rxStdin + 4);
-            }
-            else if (strcmp(rxStdin, "endlog") == 0)
-            {
-                endlog();
-                printf("NOT LOGGING\n");
-            }
-            else if (strcmp(rxStdin, "quit") == 0)
-            {
-                printf("END OF THE PROGRAM\n");
-                STOP = TRUE;
-            }
-            else if (strcmp(rxStdin, "help") == 0) {
-                help();
-            }
-            else {
-                printf("BAD COMMAND OR MISSING PARAMETERS\n");
-            }
         }
-
-        if (skipWait == FALSE) {
-            nanosleep(&nextWait, NULL);
+        if (scenario_next_time(&stepTime) && (!timerSet || timespec_comp(&stepTime, &timer.it_value) < 0))
+        {
+            timer.it_value = stepTime;
         }
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
     }
 
-    // Restore the old port settings
-    if (tcsetattr(fdRx, TCSANOW, &oldtioRx) == -1)
-    {
-        perror("tcsetattr");
-        exit(-1);
-    }
+    close(timerFd);
+    close(epfd);
+    sigprocmask(SIG_SETMASK, &waitMask, NULL);
 
-    if (tcsetattr(fdTx, TCSANOW, &oldtioTx) == -1)
+    for (int n = 0; n < nCables; ++n)
     {
-        perror("tcsetattr");
-        exit(-1);
-    }
+        struct Cable *cable = &cables[n];
 
-    close(fdTx);
-    close(fdRx);
+        // Restore the old port settings
+        if (tcsetattr(cable->fdRx, TCSANOW, &cable->oldtioRx) == -1)
+        {
+            perror("tcsetattr");
+            exit(-1);
+        }
+
+        if (tcsetattr(cable->fdTx, TCSANOW, &cable->oldtioTx) == -1)
+        {
+            perror("tcsetattr");
+            exit(-1);
+        }
+
+        close(cable->fdTx);
+        close(cable->fdRx);
+        endcapture(cable);
+    }
 
     system("killall socat");
 
@@ -0,0 +1,34 @@
+// Binary capture format of the virtual cable, read by the analyzer.
+// A header followed by one fixed size record per byte leaving the cable, in
+// host byte order (little endian on PCs). Each direction runs on its own
+// clock, so records are in time order within a direction only.
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "CABLECAP"
+#define CAPTURE_VERSION 2
+
+struct CaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t baud[2];   // Baud rate of each direction (Tx->Rx, Rx->Tx) when the capture started
+};
+
+struct CaptureRecord {
+    uint32_t time;      // usec since the start of the capture (wraps after ~71 min)
+    uint8_t byte;       // Byte as delivered (as sent, if not delivered)
+    uint8_t flags;
+    uint16_t value;     // CAP_ERROR: mask of the flipped bits; CAP_BAUD: baud / 100
+};
+
+#define CAP_RX2TX    0x01  // Direction Rx->Tx (Tx->Rx if clear)
+#define CAP_ERROR    0x02  // Bit errors injected
+#define CAP_DELETED  0x04  // Deleted by the cable, not delivered
+#define CAP_LOST     0x08  // Lost in an outage, not delivered
+#define CAP_INSERTED 0x10  // Spurious byte inserted by the cable
+#define CAP_BAUD     0x20  // Baud rate change of the direction (no byte)
+
+#endif // _CAPTURE_H_
@@ -0,0 +1,309 @@
+// Channel model of the virtual cable (see channel.h).
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+
+#define FALSE 0
+#define TRUE 1
+
+#define NO_ERROR (LLONG_MAX / 2)  // Bits to the next error when BER is 0
+#define QUEUE_MIN_SIZE 256
+
+
+// xoshiro256** pseudo-random generator. Each direction has its own, so that
+// the error positions only depend on the seed and on the bits carried in
+// that direction, not on how the two directions interleave.
+static uint64_t rng_next(struct Rng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t x = s[1] * 5;
+    uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+
+// Fill the generator state from a 64 bit seed (splitmix64)
+static void rng_seed(struct Rng *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        rng->s[i] = z ^ (z >> 31);
+    }
+}
+
+
+// Number of trials before the next event of probability p, given
+// lnNoEvent = ln(1 - p): geometric distribution, sampled by inversion
+static long long geometric_gap(struct Rng *rng, double lnNoEvent)
+{
+    if (lnNoEvent == 0.0)
+    {
+        return NO_ERROR;
+    }
+    // Uniform in (0, 1], 53 bits
+    double u = ((rng_next(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double gap = log(u) / lnNoEvent;
+    return gap < (double) NO_ERROR ? (long long) gap : NO_ERROR;
+}
+
+
+// Flip the bits of a byte that fall on error positions; returns how many.
+// ch->bitsToError counts the correct bits before the next error, across bytes.
+static int add_bit_errors(struct Channel *ch, char *byte)
+{
+    int errors = 0;
+    while (ch->bitsToError < 8)
+    {
+        *byte ^= (char) (1 << ch->bitsToError);
+        ch->bitsToError += 1 + geometric_gap(&ch->rng, ch->lnNoError[ch->bad]);
+        ++errors;
+    }
+    ch->bitsToError -= 8;
+    return errors;
+}
+
+
+// Restart the random sequences of a channel from a seed, in the good state
+static void channel_reset(struct Channel *ch, uint64_t seed)
+{
+    rng_seed(&ch->rng, seed);
+    ch->bad = FALSE;
+    ch->bitsToError = geometric_gap(&ch->rng, ch->lnNoError[0]);
+    ch->bytesToSwitch = geometric_gap(&ch->rng, ch->lnStay[0]);
+    ch->bytesToDelete = geometric_gap(&ch->rng, ch->lnNoDelete);
+    ch->bytesToInsert = geometric_gap(&ch->rng, ch->lnNoInsert);
+}
+
+
+// Apply the impairments of a channel to a byte leaving the cable. Returns
+// BYTE_OK, or BYTE_LOST / BYTE_DELETED if it is not delivered; *inserted is
+// set to a spurious byte to deliver after it, if any.
+static int channel_deliver(struct Channel *ch, char *byte, char *inserted, int *hasInserted)
+{
+    *hasInserted = FALSE;
+    ++ch->bytes;
+
+    // Gilbert-Elliott state changes happen between bytes
+    if (ch->bytesToSwitch == 0)
+    {
+        ch->bad = !ch->bad;
+        ch->bitsToError = geometric_gap(&ch->rng, ch->lnNoError[ch->bad]);
+        ch->bytesToSwitch = geometric_gap(&ch->rng, ch->lnStay[ch->bad]);
+    }
+    else
+    {
+        --ch->bytesToSwitch;
+    }
+
+    if (ch->outagePeriod > 0 && (ch->tickTime - ch->outageStart) / 1000 % ch->outagePeriod < ch->outageLength)
+    {
+        ++ch->lostInOutage;
+        return BYTE_LOST;
+    }
+
+    if (ch->bytesToDelete-- == 0)
+    {
+        ch->bytesToDelete = geometric_gap(&ch->rng, ch->lnNoDelete);
+        ++ch->deleted;
+        return BYTE_DELETED;
+    }
+
+    ch->bitErrors += add_bit_errors(ch, byte);
+
+    if (ch->bytesToInsert-- == 0)
+    {
+        ch->bytesToInsert = geometric_gap(&ch->rng, ch->lnNoInsert);
+        *inserted = (char) rng_next(&ch->rng);
+        *hasInserted = TRUE;
+        ++ch->inserted;
+    }
+    return BYTE_OK;
+}
+
+
+// Put a byte in flight, due after the propagation delay. The queue only
+// holds the bytes actually in flight and doubles when full.
+static void enqueue_byte(struct Channel *ch, char byte)
+{
+    if (ch->inFlight == ch->queueSize)
+    {
+        long size = ch->queueSize == 0 ? QUEUE_MIN_SIZE : 2 * ch->queueSize;
+        struct InFlight *queue = malloc(size * sizeof(*queue));
+        if (queue == NULL)
+        {
+            perror("Delivery queue");
+            exit(-1);
+        }
+        for (long i = 0; i < ch->inFlight; ++i)
+        {
+            queue[i] = ch->queue[(ch->head + i) % ch->queueSize];
+        }
+        free(ch->queue);
+        ch->queue = queue;
+        ch->queueSize = size;
+        ch->head = 0;
+    }
+    struct InFlight *entry = &ch->queue[(ch->head + ch->inFlight) % ch->queueSize];
+    entry->due = ch->tick + ch->delayTicks;
+    entry->byte = byte;
+    ++ch->inFlight;
+}
+
+
+// Empty the queue of bytes in flight
+static void clear_queue(struct Channel *ch)
+{
+    free(ch->queue);
+    ch->queue = NULL;
+    ch->queueSize = 0;
+    ch->head = 0;
+    ch->inFlight = 0;
+}
+
+
+void channel_init(struct Channel *ch, unsigned long baud)
+{
+    memset(ch, 0, sizeof(*ch));
+    ch->on = TRUE;
+    channel_set_baud(ch, baud);
+    channel_reset(ch, 0);
+}
+
+
+void channel_free(struct Channel *ch)
+{
+    clear_queue(ch);
+}
+
+
+void channel_set_baud(struct Channel *ch, unsigned long baud)
+{
+    // 10 bit times per byte; delay in nanoseconds
+    double delay = 1.0e10 / baud;
+    ch->byteDelay.tv_sec = 0;
+    ch->byteDelay.tv_nsec = (long) delay;
+    ch->baud = baud;
+    channel_set_prop(ch, ch->propDelay);
+}
+
+
+unsigned long channel_set_prop(struct Channel *ch, unsigned long propDelay)
+{
+    long nsecPropDelay = 1000 * propDelay;
+    long bytesInFlight = nsecPropDelay / ch->byteDelay.tv_nsec;
+    // Round instead of truncating
+    if (nsecPropDelay % ch->byteDelay.tv_nsec > ch->byteDelay.tv_nsec / 2)
+    {
+        ++bytesInFlight;
+    }
+    ch->propDelay = propDelay;
+    ch->delayTicks = bytesInFlight;
+    clear_queue(ch);
+    return bytesInFlight * ch->byteDelay.tv_nsec / 1000;
+}
+
+
+// The gaps are geometric, so drawing one again when a probability changes
+// gives the same distribution as if the new value had always been in place
+void channel_set_ber(struct Channel *ch, double ber)
+{
+    ch->lnNoError[0] = log1p(-ber);
+    if (!ch->bad)
+    {
+        ch->bitsToError = geometric_gap(&ch->rng, ch->lnNoError[0]);
+    }
+}
+
+
+void channel_set_ge(struct Channel *ch, double p, double r, double berBad)
+{
+    ch->lnStay[0] = log1p(-p);
+    ch->lnStay[1] = log1p(-r);
+    ch->lnNoError[1] = log1p(-berBad);
+    ch->bytesToSwitch = geometric_gap(&ch->rng, ch->lnStay[ch->bad]);
+    if (ch->bad)
+    {
+        ch->bitsToError = geometric_gap(&ch->rng, ch->lnNoError[1]);
+    }
+}
+
+
+void channel_set_deletion(struct Channel *ch, double p)
+{
+    ch->lnNoDelete = log1p(-p);
+    ch->bytesToDelete = geometric_gap(&ch->rng, ch->lnNoDelete);
+}
+
+
+void channel_set_insertion(struct Channel *ch, double p)
+{
+    ch->lnNoInsert = log1p(-p);
+    ch->bytesToInsert = geometric_gap(&ch->rng, ch->lnNoInsert);
+}
+
+
+void channel_set_outage(struct Channel *ch, unsigned long period, unsigned long length, unsigned long long now)
+{
+    ch->outagePeriod = period;
+    ch->outageLength = length;
+    ch->outageStart = now;
+}
+
+
+void channel_reset_pair(struct Channel ch[2], uint64_t seed)
+{
+    channel_reset(&ch[TX2RX], seed);
+    channel_reset(&ch[RX2TX], seed ^ 0x5851F42D4C957F2DULL);
+}
+
+
+void channel_tick(struct Channel *ch, unsigned long long time, const char *in, struct ChannelEvent *ev)
+{
+    ch->tickTime = time;
+    ev->left = FALSE;
+    ev->hasInserted = FALSE;
+
+    // Ignore what was read while the direction is off
+    if (in != NULL && ch->on)
+    {
+        enqueue_byte(ch, *in);
+    }
+
+    // With a constant delay, at most one byte is due per byte time. Bytes
+    // in flight when the direction is turned off are lost.
+    if (ch->inFlight > 0 && ch->queue[ch->head].due <= ch->tick)
+    {
+        ev->left = TRUE;
+        ev->sent = ch->queue[ch->head].byte;
+        ev->byte = ev->sent;
+        ch->head = (ch->head + 1) % ch->queueSize;
+        --ch->inFlight;
+        ev->status = ch->on ? channel_deliver(ch, &ev->byte, &ev->inserted, &ev->hasInserted) : BYTE_OFF;
+    }
+    ++ch->tick;
+}
+
+
+long long channel_ticks_to_delivery(const struct Channel *ch)
+{
+    if (ch->inFlight == 0 || ch->queue[ch->head].due <= ch->tick)
+    {
+        return 0;
+    }
+    return ch->queue[ch->head].due - ch->tick;
+}
@@ -0,0 +1,115 @@
+// Channel model of the virtual cable: one direction of the line, with its
+// baud rate, propagation delay, on/off state and impairments (bit errors,
+// Gilbert-Elliott bursts, byte deletion and insertion, micro-outages).
+//
+// The model has no clock of its own: the caller advances it one byte time at
+// a time with channel_tick, so the same model runs in real time in the cable
+// program and in virtual time in the simulator (simlink.h). Given the same
+// seed and the same bytes, both apply exactly the same impairments.
+
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// Directions of the cable
+#define TX2RX 0
+#define RX2TX 1
+
+// Fate of a byte leaving the cable
+#define BYTE_OK 0
+#define BYTE_LOST 1     // In an outage
+#define BYTE_DELETED 2
+#define BYTE_OFF 3      // The direction is off
+
+#define MAX_PROP_DELAY 3600000000UL  // usec
+
+struct Rng {
+    uint64_t s[4];
+};
+
+// Byte in flight and the byte time at which it leaves the cable
+struct InFlight {
+    unsigned long long due;
+    char byte;
+};
+
+// One direction of the cable. Rare events are scheduled by drawing the
+// number of bits or bytes before the next one.
+struct Channel {
+    struct Rng rng;
+    double lnNoError[2];       // ln(1 - BER) in the good and bad states
+    double lnStay[2];          // ln(1 - P(leaving the state)), per byte
+    int bad;                   // Gilbert-Elliott state
+    long long bytesToSwitch;   // Bytes before the next state change
+    long long bitsToError;     // Correct bits before the next bit error
+    double lnNoDelete;         // ln(1 - byte deletion probability)
+    long long bytesToDelete;
+    double lnNoInsert;         // ln(1 - byte insertion probability)
+    long long bytesToInsert;
+    unsigned long outagePeriod;    // Micro-outages, in usec (0 = none)
+    unsigned long outageLength;
+    unsigned long long outageStart;  // Time the outages were set, in nsec
+    unsigned long long bytes, bitErrors, deleted, inserted, lostInOutage;
+
+    // Line
+    int on;
+    unsigned long baud;
+    struct timespec byteDelay;
+    unsigned long propDelay;   // Desired propagation delay in usec
+    long delayTicks;   // Propagation delay, in byte times
+    struct InFlight *queue;  // Bytes in flight, circular, in delivery order
+    long queueSize;    // Allocated entries
+    long head;         // Next byte to leave the cable
+    long inFlight;     // Entries in the queue
+    unsigned long long tick;      // Number of the next byte time
+    unsigned long long tickTime;  // Time of the current byte time, in nsec
+};
+
+// What happened in one byte time
+struct ChannelEvent {
+    int left;          // A byte left the cable
+    int status;        // Its fate: BYTE_OK, BYTE_LOST, BYTE_DELETED or BYTE_OFF
+    char sent;         // The byte as sent
+    char byte;         // The byte as delivered (BYTE_OK)
+    int hasInserted;   // A spurious byte is delivered after it
+    char inserted;
+};
+
+// Initialize a channel: on, no impairments, no propagation delay.
+void channel_init(struct Channel *ch, unsigned long baud);
+
+// Release the memory of a channel.
+void channel_free(struct Channel *ch);
+
+// Set the baud rate (10 bits per byte). Bytes in flight are lost.
+void channel_set_baud(struct Channel *ch, unsigned long baud);
+
+// Set the propagation delay in usec, rounded to a whole number of byte
+// times. Bytes in flight are lost. Returns the actual delay in usec.
+unsigned long channel_set_prop(struct Channel *ch, unsigned long propDelay);
+
+// Impairment settings; probabilities are 0 <= p < 1. They take effect at
+// once: the gap to the next event of that kind is drawn again with the new
+// probability, continuing the random sequence (no reseeding).
+void channel_set_ber(struct Channel *ch, double ber);
+void channel_set_ge(struct Channel *ch, double p, double r, double berBad);
+void channel_set_deletion(struct Channel *ch, double p);
+void channel_set_insertion(struct Channel *ch, double p);
+
+// Cut the line for length usec every period usec, counting from now (nsec).
+void channel_set_outage(struct Channel *ch, unsigned long period, unsigned long length, unsigned long long now);
+
+// Restart the random sequences of both directions of a cable from a seed.
+void channel_reset_pair(struct Channel ch[2], uint64_t seed);
+
+// Advance the channel by one byte time, at time (nsec). in points to the
+// byte entering the cable (NULL if none); ev tells what left it.
+void channel_tick(struct Channel *ch, unsigned long long time, const char *in, struct ChannelEvent *ev);
+
+// Number of byte times before the one at which the next byte in flight
+// leaves the cable (0 if it is the next one, or none is in flight).
+long long channel_ticks_to_delivery(const struct Channel *ch);
+
+#endif // _CHANNEL_H_
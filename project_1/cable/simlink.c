@@ -0,0 +1,399 @@
+// Virtual-clock link simulator (see simlink.h).
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+#include "simlink.h"
+
+#define FALSE 0
+#define TRUE 1
+
+#define NO_DEADLINE ULLONG_MAX
+#define BYTE_QUEUE_MIN_SIZE 4096
+
+
+// Circular byte buffer that doubles when full
+struct ByteQueue {
+    unsigned char *data;
+    long size;
+    long head;
+    long len;
+};
+
+struct SimEnd {
+    int joined;       // Opened at least once
+    int open;
+    int waiting;      // Blocked in simlink_read
+    unsigned long long deadline;  // End of that read, in nsec
+    struct ByteQueue rx;          // Delivered and not read yet
+};
+
+struct SimLink {
+    char name[SIMLINK_NAME_SIZE];
+    struct Channel ch[2];
+    struct ByteQueue pending[2];      // Written, waiting to enter the line
+    unsigned long long nextTick[2];   // Time of the next byte time, in nsec
+    unsigned long long now;           // Virtual time, in nsec
+    struct SimEnd end[2];
+    int stalled;      // Nothing can happen until an endpoint writes
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    SimLink *next;
+};
+
+// Links by name
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static SimLink *registry = NULL;
+
+
+static int queue_push(struct ByteQueue *q, const unsigned char *bytes, long n)
+{
+    if (q->len + n > q->size)
+    {
+        long size = q->size == 0 ? BYTE_QUEUE_MIN_SIZE : q->size;
+        while (size < q->len + n)
+        {
+            size *= 2;
+        }
+        unsigned char *data = malloc(size);
+        if (data == NULL)
+        {
+            return -1;
+        }
+        for (long i = 0; i < q->len; ++i)
+        {
+            data[i] = q->data[(q->head + i) % q->size];
+        }
+        free(q->data);
+        q->data = data;
+        q->size = size;
+        q->head = 0;
+    }
+    for (long i = 0; i < n; ++i)
+    {
+        q->data[(q->head + q->len + i) % q->size] = bytes[i];
+    }
+    q->len += n;
+    return 0;
+}
+
+
+static long queue_pop(struct ByteQueue *q, unsigned char *bytes, long n)
+{
+    if (n > q->len)
+    {
+        n = q->len;
+    }
+    for (long i = 0; i < n; ++i)
+    {
+        bytes[i] = q->data[(q->head + i) % q->size];
+    }
+    q->head = (q->head + n) % (q->size > 0 ? q->size : 1);
+    q->len -= n;
+    return n;
+}
+
+
+static unsigned long long byte_time(const struct Channel *ch)
+{
+    return ch->byteDelay.tv_nsec;
+}
+
+
+// Run the byte times of one direction up to time t, like the cable: one
+// pending byte enters the line per byte time and, with nothing entering,
+// the byte times before the next delivery are skipped at once. Bytes that
+// leave the line go to the other endpoint.
+static void run_direction(SimLink *link, int dir, unsigned long long t)
+{
+    struct Channel *ch = &link->ch[dir];
+    struct ByteQueue *rx = &link->end[1 - dir].rx;
+    while (link->nextTick[dir] <= t)
+    {
+        if (link->pending[dir].len == 0)
+        {
+            if (ch->inFlight == 0)
+            {
+                return;  // Idle line
+            }
+            long long skip = (t - link->nextTick[dir]) / byte_time(ch);
+            if (skip > channel_ticks_to_delivery(ch))
+            {
+                skip = channel_ticks_to_delivery(ch);
+            }
+            link->nextTick[dir] += skip * byte_time(ch);
+            ch->tick += skip;
+        }
+
+        unsigned char in;
+        int entered = queue_pop(&link->pending[dir], &in, 1) == 1;
+        struct ChannelEvent ev;
+        channel_tick(ch, link->nextTick[dir], entered ? (char *) &in : NULL, &ev);
+        if (ev.left && ev.status == BYTE_OK)
+        {
+            queue_push(rx, (unsigned char *) &ev.byte, 1);
+        }
+        if (ev.hasInserted)
+        {
+            queue_push(rx, (unsigned char *) &ev.inserted, 1);
+        }
+        link->nextTick[dir] += byte_time(ch);
+    }
+}
+
+
+// Time of the next thing happening in one direction (NO_DEADLINE if none)
+static unsigned long long next_event(const SimLink *link, int dir)
+{
+    const struct Channel *ch = &link->ch[dir];
+    if (link->pending[dir].len > 0)
+    {
+        return link->nextTick[dir];
+    }
+    if (ch->inFlight > 0)
+    {
+        return link->nextTick[dir] + channel_ticks_to_delivery(ch) * byte_time(ch);
+    }
+    return NO_DEADLINE;
+}
+
+
+// An endpoint blocked in simlink_read, with nothing to read yet
+static int blocked(const SimLink *link, const struct SimEnd *end)
+{
+    return end->waiting && end->rx.len == 0 && link->now < end->deadline;
+}
+
+
+// Time may only move when both endpoints have joined and every open one
+// is blocked
+static int all_blocked(const SimLink *link)
+{
+    for (int e = 0; e < 2; ++e)
+    {
+        if (!link->end[e].joined || (link->end[e].open && !blocked(link, &link->end[e])))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+// Advance the virtual time to the next event: a byte time with a byte to
+// carry or deliver, or the deadline of a blocked read. Returns FALSE if
+// there is none.
+static int step(SimLink *link)
+{
+    unsigned long long t = NO_DEADLINE;
+    for (int d = 0; d < 2; ++d)
+    {
+        unsigned long long event = next_event(link, d);
+        if (event < t)
+        {
+            t = event;
+        }
+    }
+    for (int e = 0; e < 2; ++e)
+    {
+        if (link->end[e].open && blocked(link, &link->end[e]) && link->end[e].deadline < t)
+        {
+            t = link->end[e].deadline;
+        }
+    }
+    if (t == NO_DEADLINE)
+    {
+        return FALSE;
+    }
+
+    if (t > link->now)
+    {
+        link->now = t;
+    }
+    run_direction(link, TX2RX, link->now);
+    run_direction(link, RX2TX, link->now);
+    return TRUE;
+}
+
+
+SimLink *simlink_create(const char *name, const struct SimLinkParams *params)
+{
+    if (strlen(name) >= SIMLINK_NAME_SIZE || params->baud < 1200 || params->ber < 0 || params->ber >= 1 ||
+        params->propDelay > MAX_PROP_DELAY)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&registryLock);
+    for (SimLink *l = registry; l != NULL; l = l->next)
+    {
+        if (strcmp(l->name, name) == 0)
+        {
+            pthread_mutex_unlock(&registryLock);
+            return NULL;
+        }
+    }
+    SimLink *link = calloc(1, sizeof(*link));
+    if (link == NULL)
+    {
+        pthread_mutex_unlock(&registryLock);
+        return NULL;
+    }
+    strcpy(link->name, name);
+    for (int d = 0; d < 2; ++d)
+    {
+        channel_init(&link->ch[d], params->baud);
+        channel_set_prop(&link->ch[d], params->propDelay);
+        channel_set_ber(&link->ch[d], params->ber);
+    }
+    channel_reset_pair(link->ch, params->seed);
+    for (int e = 0; e < 2; ++e)
+    {
+        link->end[e].deadline = NO_DEADLINE;
+    }
+    pthread_mutex_init(&link->lock, NULL);
+    pthread_cond_init(&link->changed, NULL);
+    link->next = registry;
+    registry = link;
+    pthread_mutex_unlock(&registryLock);
+    return link;
+}
+
+
+void simlink_destroy(SimLink *link)
+{
+    pthread_mutex_lock(&registryLock);
+    for (SimLink **l = &registry; *l != NULL; l = &(*l)->next)
+    {
+        if (*l == link)
+        {
+            *l = link->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registryLock);
+
+    for (int d = 0; d < 2; ++d)
+    {
+        channel_free(&link->ch[d]);
+        free(link->pending[d].data);
+        free(link->end[d].rx.data);
+    }
+    pthread_mutex_destroy(&link->lock);
+    pthread_cond_destroy(&link->changed);
+    free(link);
+}
+
+
+struct Channel *simlink_channel(SimLink *link, int dir)
+{
+    return &link->ch[dir];
+}
+
+
+SimLink *simlink_open(const char *name, int end)
+{
+    pthread_mutex_lock(&registryLock);
+    SimLink *link = registry;
+    while (link != NULL && strcmp(link->name, name) != 0)
+    {
+        link = link->next;
+    }
+    pthread_mutex_unlock(&registryLock);
+    if (link == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&link->lock);
+    if (link->end[end].open)
+    {
+        pthread_mutex_unlock(&link->lock);
+        return NULL;
+    }
+    link->end[end].joined = TRUE;
+    link->end[end].open = TRUE;
+    link->stalled = FALSE;
+    pthread_cond_broadcast(&link->changed);
+    pthread_mutex_unlock(&link->lock);
+    return link;
+}
+
+
+void simlink_close(SimLink *link, int end)
+{
+    pthread_mutex_lock(&link->lock);
+    link->end[end].open = FALSE;
+    link->end[end].waiting = FALSE;
+    link->end[end].deadline = NO_DEADLINE;
+    // The other endpoint may be the only one left to wait
+    pthread_cond_broadcast(&link->changed);
+    pthread_mutex_unlock(&link->lock);
+}
+
+
+int simlink_write(SimLink *link, int end, const unsigned char *bytes, int numBytes)
+{
+    pthread_mutex_lock(&link->lock);
+    int dir = end == SIMLINK_TX ? TX2RX : RX2TX;
+    struct Channel *ch = &link->ch[dir];
+    // A byte reaching an idle line enters it on the next byte time
+    if (link->pending[dir].len == 0 && ch->inFlight == 0 && link->nextTick[dir] <= link->now)
+    {
+        link->nextTick[dir] = link->now + byte_time(ch);
+    }
+    int ret = queue_push(&link->pending[dir], bytes, numBytes) < 0 ? -1 : numBytes;
+    link->stalled = FALSE;
+    pthread_mutex_unlock(&link->lock);
+    return ret;
+}
+
+
+int simlink_read(SimLink *link, int end, unsigned char *buf, int size, int timeoutMs)
+{
+    pthread_mutex_lock(&link->lock);
+    struct SimEnd *self = &link->end[end];
+    self->deadline = timeoutMs < 0 ? NO_DEADLINE : link->now + timeoutMs * 1000000ULL;
+    self->waiting = TRUE;
+
+    // The last endpoint to wait moves the time for everyone
+    while (self->rx.len == 0 && link->now < self->deadline && !link->stalled)
+    {
+        if (all_blocked(link))
+        {
+            link->stalled = !step(link);
+            pthread_cond_broadcast(&link->changed);
+        }
+        else
+        {
+            pthread_cond_wait(&link->changed, &link->lock);
+        }
+    }
+
+    int ret = 0;
+    if (self->rx.len > 0)
+    {
+        ret = queue_pop(&self->rx, buf, size);
+    }
+    else if (link->stalled)
+    {
+        ret = -1;
+    }
+    self->waiting = FALSE;
+    self->deadline = NO_DEADLINE;
+    pthread_mutex_unlock(&link->lock);
+    return ret;
+}
+
+
+unsigned long long simlink_now(SimLink *link)
+{
+    pthread_mutex_lock(&link->lock);
+    unsigned long long now = link->now;
+    pthread_mutex_unlock(&link->lock);
+    return now;
+}
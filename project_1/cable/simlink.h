@@ -0,0 +1,70 @@
+// Virtual-clock link simulator: the channel model of the cable (channel.h)
+// between two endpoints of the same process, with no ports, socat or root.
+//
+// Time is virtual and only moves when both endpoints are blocked reading:
+// it then jumps to the next event (a byte time with a byte to carry or to
+// deliver, or the end of a read timeout), so a transfer runs as fast as the
+// CPU allows. The bytes see the same line as in the cable program: one byte
+// per byte time, the same propagation delay and, for the same seed, the
+// same impairments.
+//
+// The link layer reaches a link through a "sim:<name>" transport that the
+// program registers with transportRegister (see transport.h and sweep.c);
+// the link must have been created with simlink_create first.
+
+#ifndef _SIMLINK_H_
+#define _SIMLINK_H_
+
+#include <stdint.h>
+
+// Endpoints: the transmitter writes the Tx->Rx direction of the channel and
+// the receiver the Rx->Tx one
+#define SIMLINK_TX 0
+#define SIMLINK_RX 1
+
+#define SIMLINK_NAME_SIZE 64
+
+typedef struct SimLink SimLink;
+
+struct Channel;
+
+// Line of both directions
+struct SimLinkParams {
+    unsigned long baud;        // At least 1200 (10 bits per byte)
+    double ber;                // Bit error rate, 0 <= ber < 1
+    unsigned long propDelay;   // Propagation delay in usec
+    uint64_t seed;             // Seed of the impairments, as in the cable
+};
+
+// Create a link and register it under name. Returns NULL if the name is
+// taken or the parameters are invalid.
+SimLink *simlink_create(const char *name, const struct SimLinkParams *params);
+
+// Unregister and free a link; both endpoints must be closed.
+void simlink_destroy(SimLink *link);
+
+// Channel of one direction (TX2RX or RX2TX), e.g. to add other impairments
+// before the endpoints are opened or to read the counters afterwards.
+struct Channel *simlink_channel(SimLink *link, int dir);
+
+// Open the endpoint (SIMLINK_TX or SIMLINK_RX) of the link registered
+// under name. Returns NULL if there is no such link or the endpoint is open.
+SimLink *simlink_open(const char *name, int end);
+
+// Close an endpoint. The other one keeps running on its own.
+void simlink_close(SimLink *link, int end);
+
+// Queue numBytes to be sent from an endpoint. Never blocks.
+// Returns numBytes, or -1 on error.
+int simlink_write(SimLink *link, int end, const unsigned char *bytes, int numBytes);
+
+// Read up to size bytes delivered to an endpoint, waiting up to timeoutMs
+// milliseconds of virtual time (a negative timeout blocks).
+// Returns the number of bytes read, 0 on timeout, or -1 if nothing can
+// ever arrive (every open endpoint waits with nothing on the line).
+int simlink_read(SimLink *link, int end, unsigned char *buf, int size, int timeoutMs);
+
+// Virtual time in nsec since the link was created.
+unsigned long long simlink_now(SimLink *link);
+
+#endif // _SIMLINK_H_
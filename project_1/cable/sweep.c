@@ -0,0 +1,638 @@
+// Parameter sweep of the link layer over the virtual-clock simulator
+// (simlink.h): every combination of baud rate, BER, propagation delay and
+// I frame payload size is run in this process, one transmitter and one
+// receiver thread per point, and the efficiency is reported in virtual
+// time. No ports, socat or root are needed and a point takes as long as
+// the CPU needs, not as long as the line. With -a the endpoints go through
+// the asynchronous API (link_layer_async.h) instead of blocking calls; with
+// -m the data goes as small messages through the aggregating API
+// (link_layer_agg.h).
+//
+// Usage: sweep [options] (see usage)
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "link_layer_agg.h"
+#include "link_layer_async.h"
+#include "link_layer_ctx.h"
+#include "log.h"
+#include "simlink.h"
+#include "transport.h"
+
+#define MAX_VALUES 32
+#define DEFAULT_SIZE 65536
+#define LINK_NAME "sweep"
+
+// Values of one parameter
+struct Axis {
+    double value[MAX_VALUES];
+    int count;
+};
+
+// Endpoint of a simulated link opened by the link layer
+struct SimPort {
+    SimLink *link;
+    int end;
+};
+
+// One run: inputs and results
+struct Point {
+    SimLink *link;
+    struct SimLinkParams params;
+    const unsigned char *data;
+    long size;
+    int payload;        // Bytes per llwrite_ctx (per message with -m)
+    int timeout;        // Retransmission timeout in seconds
+    int retries;
+    int async;          // Use link_layer_async.h
+    int aggDelay;       // Use link_layer_agg.h with this deadline in ms (-1: no)
+    long interval;      // Real time between messages with -m, in usec
+    double *sentAt;     // Real time each message was given to ll_agg_send
+    double maxLatency;  // Worst real time from ll_agg_send to ll_agg_recv
+    int frames;         // Frames that carried the messages
+    unsigned char *received;
+    long receivedSize;
+    unsigned long long doneTime;  // Virtual time of the last byte, nsec
+};
+
+
+void usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  -f <file>    data to send (default %d pseudo-random bytes)\n"
+           "  -b <list>    baud rates (default 9600,38400,115200)\n"
+           "  -e <list>    bit error rates (default 0,1e-5,5e-5)\n"
+           "  -p <list>    propagation delays in usec (default 0,10000,100000)\n"
+           "  -F <list>    I frame payload sizes, at most %d (default 250,500,1000)\n"
+           "  -t <sec>     retransmission timeout (default 4)\n"
+           "  -r <n>       number of retransmissions (default 10)\n"
+           "  -s <n>       seed of the bit errors (default 1)\n"
+           "  -a           run the endpoints through the asynchronous API: the\n"
+           "               transmitter submits ahead and collects completions on\n"
+           "               the eventfd, the receiver is driven by callbacks\n"
+           "  -m <ms>      send messages of the -F sizes through the aggregating\n"
+           "               API with a deadline of <ms> milliseconds\n"
+           "  -i <usec>    with -m, real time between messages (default 0)\n"
+           "  -h           show this help\n"
+           "\n"
+           "Lists are comma separated. Every combination is run; S is the\n"
+           "efficiency: data bits over the bits the line could carry in the\n"
+           "(virtual) time from SET to the last data byte. With -m each line also\n"
+           "shows the messages per frame and the worst delivery latency in real\n"
+           "time (with -i the senders sleep in real time, not in virtual time).\n",
+           program, DEFAULT_SIZE, MAX_PAYLOAD_SIZE);
+}
+
+
+// Backend of the "sim:<name>" transport: the link layer runs over a link
+// created with simlink_create
+void *sim_open(const char *name, LinkLayerRole role)
+{
+    struct SimPort *port = malloc(sizeof(*port));
+    if (port == NULL)
+    {
+        return NULL;
+    }
+    port->end = role == LlTx ? SIMLINK_TX : SIMLINK_RX;
+    port->link = simlink_open(name, port->end);
+    if (port->link == NULL)
+    {
+        free(port);
+        return NULL;
+    }
+    return port;
+}
+
+
+void sim_close(void *handle)
+{
+    struct SimPort *port = handle;
+    simlink_close(port->link, port->end);
+    free(port);
+}
+
+
+int sim_read(void *handle, unsigned char *buf, int size, int timeoutMs)
+{
+    struct SimPort *port = handle;
+    return simlink_read(port->link, port->end, buf, size, timeoutMs);
+}
+
+
+int sim_write(void *handle, const unsigned char *bytes, int numBytes)
+{
+    struct SimPort *port = handle;
+    return simlink_write(port->link, port->end, bytes, numBytes);
+}
+
+
+void sim_now(void *handle, struct timespec *now)
+{
+    struct SimPort *port = handle;
+    unsigned long long nsec = simlink_now(port->link);
+    now->tv_sec = nsec / 1000000000ULL;
+    now->tv_nsec = nsec % 1000000000ULL;
+}
+
+
+static const TransportBackend simBackend = { sim_open, sim_close, sim_read, sim_write, sim_now };
+
+
+// Parse a comma separated list of numbers into an axis
+int parse_axis(const char *list, struct Axis *axis)
+{
+    char copy[1024];
+    snprintf(copy, sizeof(copy), "%s", list);
+    axis->count = 0;
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        char *end;
+        double value = strtod(item, &end);
+        if (end == item || *end != '\0' || value < 0 || axis->count == MAX_VALUES)
+        {
+            printf("Invalid list: %s\n", list);
+            return -1;
+        }
+        axis->value[axis->count++] = value;
+    }
+    return axis->count > 0 ? 0 : -1;
+}
+
+
+// Store a received packet; returns FALSE once every byte has arrived
+int store_packet(struct Point *point, const unsigned char *packet, int n)
+{
+    if (point->receivedSize + n > point->size)
+    {
+        n = point->size - point->receivedSize;
+    }
+    memcpy(point->received + point->receivedSize, packet, n);
+    point->receivedSize += n;
+    return point->receivedSize < point->size;
+}
+
+
+double real_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+// Receiver of the -m messages: ll_agg_recv splits the frames back
+void aggregated_receive(struct Point *point, ll_ctx *ctx)
+{
+    ll_agg *agg = ll_agg_create(ctx, point->aggDelay);
+    if (agg == NULL)
+    {
+        printf("Cannot start the aggregating receiver\n");
+        exit(-1);
+    }
+    unsigned char msg[LL_AGG_MAX_MESSAGE];
+    for (long i = 0; point->receivedSize < point->size; i++)
+    {
+        int n = ll_agg_recv(agg, msg);
+        if (n < 0)
+        {
+            break;
+        }
+        double latency = real_time() - point->sentAt[i];
+        if (latency > point->maxLatency)
+        {
+            point->maxLatency = latency;
+        }
+        store_packet(point, msg, n);
+    }
+    point->frames = ll_agg_frames(agg);
+    ll_agg_destroy(agg);
+}
+
+
+// Transmitter of the -m messages, as fast as they are taken or one every
+// interval usec
+void aggregated_transmit(struct Point *point, ll_ctx *ctx)
+{
+    ll_agg *agg = ll_agg_create(ctx, point->aggDelay);
+    if (agg == NULL)
+    {
+        printf("Cannot start the aggregating transmitter\n");
+        exit(-1);
+    }
+    for (long sent = 0, i = 0; sent < point->size; i++)
+    {
+        int n = point->size - sent < point->payload ? point->size - sent : point->payload;
+        if (point->interval > 0)
+        {
+            usleep(point->interval);
+        }
+        point->sentAt[i] = real_time();
+        if (ll_agg_send(agg, point->data + sent, n) < 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    ll_agg_destroy(agg);
+}
+
+
+// Receiver driven by ll_async callbacks: each completed read submits the
+// next one from the worker thread until the data is in or the link is gone
+struct AsyncReceiver {
+    struct Point *point;
+    ll_ctx *ctx;
+    ll_async *engine;
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int done;
+};
+
+
+void async_read_done(const LlCompletion *completion)
+{
+    struct AsyncReceiver *rx = completion->user;
+    int more = completion->result > 0 ? store_packet(rx->point, completion->packet, completion->result)
+                                      : !llbroken_ctx(rx->ctx);  // Rejected frame, unless the link is gone
+    if (more && ll_async_read(rx->engine, rx->packet, async_read_done, rx) == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&rx->lock);
+    rx->done = TRUE;
+    pthread_cond_signal(&rx->finished);
+    pthread_mutex_unlock(&rx->lock);
+}
+
+
+void async_receive(struct Point *point, ll_ctx *ctx)
+{
+    struct AsyncReceiver rx = { .point = point, .ctx = ctx, .lock = PTHREAD_MUTEX_INITIALIZER,
+                                .finished = PTHREAD_COND_INITIALIZER };
+    rx.engine = ll_async_create(ctx);
+    if (rx.engine == NULL || ll_async_read(rx.engine, rx.packet, async_read_done, &rx) < 0)
+    {
+        printf("Cannot start the asynchronous receiver\n");
+        exit(-1);
+    }
+    pthread_mutex_lock(&rx.lock);
+    while (!rx.done)
+    {
+        pthread_cond_wait(&rx.finished, &rx.lock);
+    }
+    pthread_mutex_unlock(&rx.lock);
+    ll_async_destroy(rx.engine);
+}
+
+
+// Transmitter through ll_async: keep the queue full and wait for the
+// completions on the eventfd
+void async_transmit(struct Point *point, ll_ctx *ctx)
+{
+    ll_async *engine = ll_async_create(ctx);
+    if (engine == NULL)
+    {
+        printf("Cannot start the asynchronous transmitter\n");
+        exit(-1);
+    }
+    struct pollfd pfd = { .fd = ll_async_eventfd(engine), .events = POLLIN };
+    long submitted = 0, acked = 0;
+    int pending = 0, failed = FALSE;
+    while (acked < point->size && !failed)
+    {
+        while (submitted < point->size && pending < LL_ASYNC_QUEUE_SIZE)
+        {
+            int n = point->size - submitted < point->payload ? point->size - submitted : point->payload;
+            if (ll_async_write(engine, point->data + submitted, n, NULL, (void *) (long) n) < 0)
+            {
+                break;
+            }
+            submitted += n;
+            pending++;
+        }
+
+        poll(&pfd, 1, -1);
+        LlCompletion done[LL_ASYNC_QUEUE_SIZE];
+        int count = ll_async_poll(engine, done, LL_ASYNC_QUEUE_SIZE);
+        for (int i = 0; i < count; i++)
+        {
+            pending--;
+            if (done[i].result < 0)
+            {
+                failed = TRUE;
+            }
+            acked += (long) done[i].user;
+        }
+    }
+    ll_async_destroy(engine);
+}
+
+
+void *receiver(void *arg)
+{
+    struct Point *point = arg;
+    LinkLayer params = { .role = LlRx, .baudRate = point->params.baud,
+                         .nRetransmissions = point->retries, .timeout = point->timeout };
+    snprintf(params.serialPort, sizeof(params.serialPort), "sim:%s", LINK_NAME);
+    ll_ctx *ctx = llopen_ctx(params);
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+    if (point->aggDelay >= 0)
+    {
+        aggregated_receive(point, ctx);
+        point->doneTime = simlink_now(point->link);
+        llclose_ctx(ctx, FALSE);
+        return NULL;
+    }
+    if (point->async)
+    {
+        async_receive(point, ctx);
+        point->doneTime = simlink_now(point->link);
+        llclose_ctx(ctx, FALSE);
+        return NULL;
+    }
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    while (point->receivedSize < point->size)
+    {
+        int n = llread_ctx(ctx, packet);
+        if (n <= 0)
+        {
+            // Rejected frame, unless the link is gone
+            if (llbroken_ctx(ctx))
+            {
+                break;
+            }
+            continue;
+        }
+        store_packet(point, packet, n);
+    }
+    point->doneTime = simlink_now(point->link);
+    llclose_ctx(ctx, FALSE);
+    return NULL;
+}
+
+
+void *transmitter(void *arg)
+{
+    struct Point *point = arg;
+    LinkLayer params = { .role = LlTx, .baudRate = point->params.baud,
+                         .nRetransmissions = point->retries, .timeout = point->timeout };
+    snprintf(params.serialPort, sizeof(params.serialPort), "sim:%s", LINK_NAME);
+    ll_ctx *ctx = llopen_ctx(params);
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+    if (point->aggDelay >= 0)
+    {
+        aggregated_transmit(point, ctx);
+        llclose_ctx(ctx, FALSE);
+        return NULL;
+    }
+    if (point->async)
+    {
+        async_transmit(point, ctx);
+        llclose_ctx(ctx, FALSE);
+        return NULL;
+    }
+
+    for (long sent = 0; sent < point->size;)
+    {
+        int n = point->size - sent < point->payload ? point->size - sent : point->payload;
+        if (llwrite_ctx(ctx, point->data + sent, n) < 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    llclose_ctx(ctx, FALSE);
+    return NULL;
+}
+
+
+// Run one point of the sweep and print its line of the table
+void run_point(struct Point *point)
+{
+    point->link = simlink_create(LINK_NAME, &point->params);
+    if (point->link == NULL)
+    {
+        printf("Invalid parameters: %lu baud, BER %g, %lu usec\n", point->params.baud, point->params.ber,
+               point->params.propDelay);
+        return;
+    }
+    point->receivedSize = 0;
+    point->doneTime = 0;
+    point->maxLatency = 0;
+    point->frames = 0;
+    if (point->aggDelay >= 0)
+    {
+        point->sentAt = calloc(point->size / point->payload + 1, sizeof(double));
+        if (point->sentAt == NULL)
+        {
+            perror("calloc");
+            exit(-1);
+        }
+    }
+
+    pthread_t rx, tx;
+    pthread_create(&rx, NULL, receiver, point);
+    pthread_create(&tx, NULL, transmitter, point);
+    pthread_join(tx, NULL);
+    pthread_join(rx, NULL);
+    logFlush();
+
+    int ok = point->receivedSize == point->size && memcmp(point->received, point->data, point->size) == 0;
+    double seconds = point->doneTime / 1e9;
+    const struct Channel *ch = simlink_channel(point->link, TX2RX);
+    printf("%7lu %8.1e %9lu %6d %11.3f %6.3f %10llu %7llu  ", point->params.baud, point->params.ber,
+           point->params.propDelay, point->payload, seconds,
+           ok && seconds > 0 ? point->size * 8 / (seconds * point->params.baud) : 0.0, ch->bytes,
+           ch->bitErrors);
+    printf(point->aggDelay >= 0 ? "%-6s" : "%s", ok ? "OK" : "FAILED");
+    if (point->aggDelay >= 0)
+    {
+        long messages = (point->size + point->payload - 1) / point->payload;
+        printf(" %9.1f %8.2f", point->frames > 0 ? (double) messages / point->frames : 0.0,
+               point->maxLatency * 1e3);
+        free(point->sentAt);
+    }
+    printf("\n");
+    simlink_destroy(point->link);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct Axis bauds, bers, props, payloads;
+    parse_axis("9600,38400,115200", &bauds);
+    parse_axis("0,1e-5,5e-5", &bers);
+    parse_axis("0,10000,100000", &props);
+    parse_axis("250,500,1000", &payloads);
+    const char *filename = NULL;
+    struct Point point = { .timeout = 4, .retries = 10, .aggDelay = -1, .params.seed = 1 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:b:e:p:F:t:r:s:am:i:h")) != -1)
+    {
+        int ret = 0;
+        switch (opt)
+        {
+            case 'f':
+                filename = optarg;
+                break;
+            case 'b':
+                ret = parse_axis(optarg, &bauds);
+                break;
+            case 'e':
+                ret = parse_axis(optarg, &bers);
+                break;
+            case 'p':
+                ret = parse_axis(optarg, &props);
+                break;
+            case 'F':
+                ret = parse_axis(optarg, &payloads);
+                break;
+            case 't':
+                point.timeout = atoi(optarg);
+                break;
+            case 'r':
+                point.retries = atoi(optarg);
+                break;
+            case 's':
+                point.params.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'a':
+                point.async = TRUE;
+                break;
+            case 'm':
+                point.aggDelay = atoi(optarg);
+                break;
+            case 'i':
+                point.interval = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? 0 : -1);
+        }
+        if (ret != 0)
+        {
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < payloads.count; i++)
+    {
+        if (payloads.value[i] < 1 || payloads.value[i] > MAX_PAYLOAD_SIZE)
+        {
+            printf("The payload size must be 1 to %d\n", MAX_PAYLOAD_SIZE);
+            exit(-1);
+        }
+    }
+
+    // Data to send
+    unsigned char *data;
+    if (filename != NULL)
+    {
+        FILE *file = fopen(filename, "rb");
+        if (file == NULL)
+        {
+            perror(filename);
+            exit(-1);
+        }
+        fseek(file, 0, SEEK_END);
+        point.size = ftell(file);
+        rewind(file);
+        data = malloc(point.size > 0 ? point.size : 1);
+        if (data == NULL || fread(data, 1, point.size, file) != (size_t) point.size)
+        {
+            perror(filename);
+            exit(-1);
+        }
+        fclose(file);
+    }
+    else
+    {
+        point.size = DEFAULT_SIZE;
+        data = malloc(point.size);
+        if (data == NULL)
+        {
+            perror("malloc");
+            exit(-1);
+        }
+        srand(1);
+        for (long i = 0; i < point.size; i++)
+        {
+            data[i] = rand();
+        }
+    }
+    point.data = data;
+    point.received = malloc(point.size > 0 ? point.size : 1);
+    if (point.received == NULL)
+    {
+        perror("malloc");
+        exit(-1);
+    }
+
+    if (transportRegister("sim", &simBackend) < 0)
+    {
+        printf("Cannot register the sim transport\n");
+        exit(-1);
+    }
+
+    // Only warnings from the link layer, on stderr, unless LL_LOG says otherwise
+    if (getenv("LL_LOG") == NULL)
+    {
+        logLevel = LOG_LEVEL_WARN;
+    }
+
+    printf("%ld bytes, timeout %d s, %d retransmissions, seed %llu%s\n", point.size, point.timeout,
+           point.retries, (unsigned long long) point.params.seed, point.async ? ", asynchronous API" : "");
+    if (point.aggDelay >= 0)
+    {
+        printf("Messages of the frame sizes, aggregated with a %d ms deadline, one every %ld usec\n",
+               point.aggDelay, point.interval);
+    }
+    printf("\n   baud      BER prop usec  frame  time (s)      S  line bytes  errors%s\n",
+           point.aggDelay >= 0 ? "          msg/frame  max ms" : "");
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double simulated = 0;
+    int points = 0;
+    for (int b = 0; b < bauds.count; b++)
+    {
+        for (int e = 0; e < bers.count; e++)
+        {
+            for (int p = 0; p < props.count; p++)
+            {
+                for (int f = 0; f < payloads.count; f++)
+                {
+                    point.params.baud = bauds.value[b];
+                    point.params.ber = bers.value[e];
+                    point.params.propDelay = props.value[p];
+                    point.payload = payloads.value[f];
+                    run_point(&point);
+                    simulated += point.doneTime / 1e9;
+                    points++;
+                }
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("\n%d points, %.1f s of line time simulated in %.2f s\n", points, simulated,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    free(point.received);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,22 @@
+// Bonded application layer header.
+// Stripes one file transfer across several independent links.
+
+#ifndef _BONDING_H_
+#define _BONDING_H_
+
+// Maximum number of links in a bond.
+#define MAX_BOND_LINKS 8
+
+// Bonded application layer main function.
+// Arguments:
+//   serialPorts: Comma separated list of port names (e.g., /dev/ttyS10,/dev/ttyS12).
+//   role: Application role {"tx", "rx"}.
+//   baudrate: Baudrate of the serial ports.
+//   nTries: Maximum number of frame retries.
+//   timeout: Frame timeout.
+//   filename: Name of the file to send / receive.
+// Returns -1 on error.
+int bondedApplicationLayer(const char *serialPorts, const char *role, int baudRate,
+                           int nTries, int timeout, const char *filename);
+
+#endif // _BONDING_H_
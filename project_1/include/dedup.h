@@ -0,0 +1,37 @@
+// Chunk deduplication header.
+// Content-defined chunking (gear rolling hash) splits a byte stream at
+// positions that depend only on the nearby content, so repeated blocks
+// produce the same chunks wherever they appear. A chunk index maps the
+// SHA-256 of each chunk to where it was first seen.
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include "sha256.h"
+#include <sys/types.h>
+
+// Chunk size limits; boundaries average about 4 KiB in between.
+#define DEDUP_CHUNK_MIN 1024
+#define DEDUP_CHUNK_MAX 16384
+
+// Length of the chunk starting at data, cut at the first content-defined
+// boundary within len bytes (never above DEDUP_CHUNK_MAX).
+// Return len if no boundary is found before it.
+int dedupCut(const unsigned char *data, int len);
+
+typedef struct ChunkIndex ChunkIndex;
+
+// Return a new empty index or NULL on error.
+ChunkIndex *chunkIndexCreate(void);
+
+void chunkIndexDestroy(ChunkIndex *index);
+
+// Record that the chunk with this hash is stored at offset.
+// Return "0" on success or "-1" on error.
+int chunkIndexAdd(ChunkIndex *index, const unsigned char hash[SHA256_SIZE], off_t offset, unsigned length);
+
+// Look up a chunk by hash.
+// Return TRUE and fill offset and length if found, FALSE otherwise.
+int chunkIndexFind(const ChunkIndex *index, const unsigned char hash[SHA256_SIZE], off_t *offset, unsigned *length);
+
+#endif // _DEDUP_H_
@@ -0,0 +1,43 @@
+// File digest header.
+// Hashes the contents of a file in order while it is transferred: a
+// SHA-256 of every fixed-size region, so a mismatch can be narrowed down to
+// the regions that differ, and a file hash that is the SHA-256 of those
+// region hashes. A region of zeros given as NULL data (a hole) costs one
+// precomputed hash instead of hashing its bytes.
+
+#ifndef _FILE_DIGEST_H_
+#define _FILE_DIGEST_H_
+
+#include "sha256.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+// Size of each region and of its (truncated SHA-256) hash.
+#define DIGEST_REGION_SIZE 65536
+#define DIGEST_REGION_HASH_SIZE 8
+
+// Called every time a region is complete (the last one may be shorter).
+// Regions made only of zeros given as NULL data (holes) are not reported:
+// their hash is known to both ends without being sent.
+typedef void (*RegionCallback)(void *user, uint64_t region, const unsigned char *hash);
+
+typedef struct
+{
+    Sha256 file;          // Over the SHA-256 of each region.
+    Sha256 region;
+    unsigned regionFill;  // Bytes hashed in the current region.
+    uint64_t regionIndex; // Index of the current region.
+    int regionHole;       // The current region has only had NULL data so far.
+    RegionCallback onRegion;
+    void *user;
+} FileDigest;
+
+void digestInit(FileDigest *d, RegionCallback onRegion, void *user);
+
+// Hash the next len bytes of the file. If data is NULL they are zeros.
+void digestUpdate(FileDigest *d, const unsigned char *data, off_t len);
+
+// Close the last region and store the SHA-256 of the whole file in out.
+void digestFinal(FileDigest *d, unsigned char out[SHA256_SIZE]);
+
+#endif // _FILE_DIGEST_H_
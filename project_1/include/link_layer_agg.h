@@ -0,0 +1,46 @@
+// Aggregating link layer header.
+// Small messages given to ll_agg_send are packed into one I frame, each
+// prefixed by its 2-byte length, so a burst of tiny records costs one
+// frame header and one acknowledgement instead of one per record. A batch
+// is sent when the next message no longer fits in the frame or when the
+// oldest queued message has waited maxDelayMs, whichever comes first.
+// The receiver splits the frames back into the original messages.
+
+#ifndef _LINK_LAYER_AGG_H_
+#define _LINK_LAYER_AGG_H_
+
+#include "link_layer_ctx.h"
+
+// Largest message accepted by ll_agg_send.
+#define LL_AGG_MAX_MESSAGE (MAX_PAYLOAD_SIZE - 2)
+
+typedef struct ll_agg ll_agg;
+
+// Start aggregating on an open link. A flusher thread sends partial
+// batches once their oldest message is maxDelayMs old, so a message is
+// delivered at most maxDelayMs plus one frame exchange after being sent.
+// Return the new aggregator or NULL on error.
+ll_agg *ll_agg_create(ll_ctx *ctx, int maxDelayMs);
+
+// Queue a message of size bytes (at most LL_AGG_MAX_MESSAGE).
+// Blocks only while a full batch is being sent.
+// Return "0" on success or "-1" on error (including an earlier failed send).
+int ll_agg_send(ll_agg *agg, const unsigned char *msg, int size);
+
+// Send the queued messages now.
+// Return "0" on success or "-1" on error.
+int ll_agg_flush(ll_agg *agg);
+
+// Receive the next message in msg (at least LL_AGG_MAX_MESSAGE bytes).
+// Return its size, or "-1" once the link is broken.
+int ll_agg_recv(ll_agg *agg, unsigned char *msg);
+
+// Number of frames sent (by ll_agg_send, ll_agg_flush and the flusher) or
+// received (by ll_agg_recv) so far.
+int ll_agg_frames(ll_agg *agg);
+
+// Flush, stop the flusher thread and free the aggregator. The link itself
+// is left open.
+void ll_agg_destroy(ll_agg *agg);
+
+#endif // _LINK_LAYER_AGG_H_
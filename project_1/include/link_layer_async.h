@@ -0,0 +1,67 @@
+// Asynchronous link layer header.
+// Operations submitted on an ll_async are executed in order by a worker
+// thread on the underlying ll_ctx, so the caller never blocks on the
+// send->ACK cycle or on a frame arriving. Completions are reported through
+// a callback or queued and signalled on an eventfd.
+//
+// The link itself is still stop-and-wait: only one frame per link is on the
+// line at a time, and the queue lets the caller submit ahead of the ACKs.
+// One thread can drive several links by polling the eventfd of each engine
+// (see the -a option of cable/sweep.c).
+
+#ifndef _LINK_LAYER_ASYNC_H_
+#define _LINK_LAYER_ASYNC_H_
+
+#include "link_layer_ctx.h"
+
+// Maximum number of operations submitted and not yet completed.
+#define LL_ASYNC_QUEUE_SIZE 64
+
+typedef struct ll_async ll_async;
+
+typedef enum
+{
+    LlAsyncWrite,
+    LlAsyncRead,
+} LlAsyncOp;
+
+typedef struct
+{
+    LlAsyncOp op;
+    unsigned char *packet; // Read: buffer given to ll_async_read. Write: NULL.
+    int result;            // Return value of llwrite_ctx / llread_ctx.
+    void *user;            // Pointer given on submission.
+} LlCompletion;
+
+// Called from the worker thread when an operation completes.
+typedef void (*LlCallback)(const LlCompletion *completion);
+
+// Start the worker thread for an open link.
+// Return the new engine or NULL on error.
+ll_async *ll_async_create(ll_ctx *ctx);
+
+// Queue a frame for sending. buf is copied, so it can be reused on return.
+// Once a write fails, the writes queued after it complete with "-1" without
+// being sent, so the peer never gets the data out of order.
+// If cb is NULL the completion is queued for ll_async_poll.
+// Return "0" on success or "-1" if the queue is full or bufSize is too big.
+int ll_async_write(ll_async *a, const unsigned char *buf, int bufSize, LlCallback cb, void *user);
+
+// Queue a frame reception into packet (which must stay valid until completion).
+// If cb is NULL the completion is queued for ll_async_poll.
+// Return "0" on success or "-1" if the queue is full.
+int ll_async_read(ll_async *a, unsigned char *packet, LlCallback cb, void *user);
+
+// Descriptor that becomes readable when completions are waiting for
+// ll_async_poll (e.g. for poll/select/epoll).
+int ll_async_eventfd(const ll_async *a);
+
+// Retrieve up to max queued completions without blocking.
+// Return the number of completions stored in out.
+int ll_async_poll(ll_async *a, LlCompletion *out, int max);
+
+// Wait until every submitted operation completes, then stop the worker and
+// free the engine. The link itself is left open.
+void ll_async_destroy(ll_async *a);
+
+#endif // _LINK_LAYER_ASYNC_H_
@@ -0,0 +1,79 @@
+// Reentrant link layer header.
+// Every connection keeps its own state (transport, sequence number, timer
+// and statistics) in an ll_ctx, so one process can drive several links at
+// once, each from its own thread. The functions in link_layer.h are thin
+// wrappers around a single default context.
+
+#ifndef _LINK_LAYER_CTX_H_
+#define _LINK_LAYER_CTX_H_
+
+#include "link_layer.h"
+#include <stdatomic.h>
+
+typedef struct ll_ctx ll_ctx;
+
+// Default maximum size of an I frame on the wire (after stuffing).
+#define LL_DEFAULT_FRAME_SIZE 512
+
+// Framing of I frames on the wire.
+typedef enum
+{
+    LlFramingHdlc, // Byte stuffing: FLAG and ESC cost 2 bytes each (up to 2x).
+    LlFramingCobs, // COBS: fixed overhead of at most 1 byte per 254.
+} LlFraming;
+
+// Options negotiated when the link is opened.
+typedef struct
+{
+    LlFraming framing; // Requested by the transmitter; the receiver follows it.
+    int probe;         // Transmitter: measure the link after SET/UA and pick
+                       // the frame size and retransmission timeout from it.
+    const atomic_int *cancel; // Receiver: once *cancel is TRUE, a retransmission
+                       // timeout without a byte gives up (llopen_ctx fails,
+                       // llread_ctx returns -1 and llbroken_ctx becomes TRUE).
+                       // NULL waits for the peer forever.
+} LlOptions;
+
+// Fill options with the defaults: HDLC framing unless the environment
+// variable LL_FRAMING is "cobs", and no probe unless LL_PROBE is set.
+void lldefaultoptions(LlOptions *options);
+
+// Open a connection using the "port" parameters defined in struct linkLayer.
+// Return the new context on success or NULL on error.
+ll_ctx *llopen_ctx(LinkLayer connectionParameters);
+
+// Same as llopen_ctx with explicit options (NULL for the defaults).
+// The transmitter requests options->framing in its SET; a receiver that
+// understands it confirms with the matching UA.
+ll_ctx *llopen_ctx_opts(LinkLayer connectionParameters, const LlOptions *options);
+
+// Send data in buf with size bufSize.
+// Return number of chars written, or "-1" on error.
+int llwrite_ctx(ll_ctx *ctx, const unsigned char *buf, int bufSize);
+
+// Receive data in packet.
+// Return number of chars read, or "-1" on error.
+int llread_ctx(ll_ctx *ctx, unsigned char *packet);
+
+// Close the connection and free the context.
+// if showStatistics == TRUE, link layer should print statistics in the console on close.
+// Return "1" on success or "-1" on error.
+int llclose_ctx(ll_ctx *ctx, int showStatistics);
+
+// Descriptor of the underlying transport (e.g. for poll/select).
+int llfd_ctx(const ll_ctx *ctx);
+
+// Return TRUE if the channel failed or was closed by the peer, after which
+// every llread_ctx call fails.
+int llbroken_ctx(const ll_ctx *ctx);
+
+// Maximum size of an I frame on the wire (after stuffing) for this link.
+int llframesize_ctx(const ll_ctx *ctx);
+
+// Packetizer helper: largest n such that the frame carrying header followed
+// by the first n bytes of data fits in llframesize_ctx bytes on the wire,
+// accounting for the stuffing (or COBS) overhead of every byte (including BCC2).
+// Return n, or "-1" if not even the header fits.
+int llfit_ctx(const ll_ctx *ctx, const unsigned char *header, int headerLen, const unsigned char *data, int dataLen);
+
+#endif // _LINK_LAYER_CTX_H_
@@ -0,0 +1,56 @@
+// Logger header.
+// Leveled logging that keeps terminal and pipe writes off the frame path:
+// messages are formatted into a lock-free ring and written to stderr by a
+// background thread, so a slow terminal never delays an ACK. If the ring is
+// full the message is dropped (and counted) instead of blocking. The thread
+// runs with SCHED_OTHER on any CPU, even in the real-time mode, and sleeps
+// while the ring is empty; if it cannot be started messages are written
+// directly.
+//
+// Levels below LOG_COMPILE_LEVEL are removed at compile time (e.g. build
+// with -DLOG_COMPILE_LEVEL=LOG_LEVEL_INFO); the rest are filtered at run
+// time by LL_LOG=error|warn|info|debug (default info), read at program
+// start. Arguments of a filtered message are not evaluated.
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Longest message kept; longer ones are truncated.
+#define LOG_LINE_SIZE 240
+
+// Messages waiting to be written (power of 2).
+#define LOG_RING_SIZE 1024
+
+extern int logLevel;
+
+// Queue a printf-style message. Use the LOG_* macros instead.
+void logWrite(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Wait until every queued message has been written (e.g. before printing
+// directly to the terminal).
+void logFlush(void);
+
+#define LOG(level, ...)                                               \
+    do                                                                \
+    {                                                                 \
+        if ((level) <= LOG_COMPILE_LEVEL && (level) <= logLevel)      \
+        {                                                             \
+            logWrite(level, __VA_ARGS__);                             \
+        }                                                             \
+    } while (0)
+
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif // _LOG_H_
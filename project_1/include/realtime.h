@@ -0,0 +1,34 @@
+// Real-time support header.
+// Opt-in low-jitter mode for the link process and a fixed-size latency
+// histogram used to measure the frame-to-acknowledgement turnaround.
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <time.h>
+
+// Enable the real-time mode if the environment asks for it:
+//   LL_RT=1          SCHED_FIFO priority, locked and prefaulted memory.
+//   LL_RT_PRIO=<n>   SCHED_FIFO priority (default 50, like the cable).
+//   LL_RT_CPU=<n>    Pin the process to CPU n.
+// Failures are reported and the process keeps running without them.
+// Return TRUE if the mode was requested.
+int rtSetup(void);
+
+// Log-linear buckets: exact below 64 us, then 32 buckets per power of two.
+#define LATENCY_BUCKETS 896
+
+typedef struct
+{
+    unsigned counts[LATENCY_BUCKETS];
+    unsigned n;
+    unsigned maxUs;
+} LatencyHist;
+
+// Add the time elapsed since start (CLOCK_MONOTONIC). Never allocates.
+void latencyRecord(LatencyHist *h, const struct timespec *start);
+
+// Print count, p50, p90, p99, p99.9 and max under label.
+void latencyPrint(const LatencyHist *h, const char *label);
+
+#endif // _REALTIME_H_
@@ -0,0 +1,31 @@
+// SHA-256 header.
+// Streaming SHA-256 (FIPS 180-4) used to identify file contents.
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;        // Bytes hashed so far.
+    unsigned char block[64]; // Partial input block.
+    size_t blockLen;
+} Sha256;
+
+void sha256Init(Sha256 *sha);
+
+// Hash len more bytes of data.
+void sha256Update(Sha256 *sha, const void *data, size_t len);
+
+// Finish and store the digest in out.
+void sha256Final(Sha256 *sha, unsigned char out[SHA256_SIZE]);
+
+// Digest of a single buffer.
+void sha256(const void *data, size_t len, unsigned char out[SHA256_SIZE]);
+
+#endif // _SHA256_H_
@@ -0,0 +1,28 @@
+// Event trace header.
+// Low-overhead per-frame tracing: events are stored in a preallocated ring
+// buffer and written at exit in Chrome trace_event JSON (array format), which
+// chrome://tracing and ui.perfetto.dev can open. Enabled with LL_TRACE=<file>;
+// both sides of a transfer may use the same file to share one timeline
+// (remove it before the run, events are appended).
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+// Events kept in memory; older ones are overwritten.
+#define TRACE_RING_SIZE 65536
+
+extern int traceEnabled;
+
+// Enable tracing if LL_TRACE is set. processName labels this side (e.g. "tx").
+void traceInit(const char *processName);
+
+// Record an event. phase is 'B' (begin), 'E' (end) or 'i' (instant).
+// name must be a string literal (only the pointer is stored).
+void traceEvent(const char *name, char phase, long arg);
+
+// Costs one test of a global flag when tracing is off.
+#define TRACE_BEGIN(name) do { if (traceEnabled) traceEvent(name, 'B', 0); } while (0)
+#define TRACE_END(name) do { if (traceEnabled) traceEvent(name, 'E', 0); } while (0)
+#define TRACE_INSTANT(name, arg) do { if (traceEnabled) traceEvent(name, 'i', arg); } while (0)
+
+#endif // _TRACE_H_
@@ -0,0 +1,72 @@
+// Transport backend header.
+// Abstracts the byte channel used by the link layer, so the same protocol
+// can run over a serial port, a UNIX socket, a FIFO pair, UDP or a channel
+// registered by the program (e.g. a simulated line with a virtual clock).
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "link_layer.h"
+#include <time.h>
+
+typedef struct Transport Transport;
+
+// Byte channel provided by the program itself, without a descriptor (e.g.
+// the virtual-clock simulator registered by the sweep tool).
+typedef struct
+{
+    // Open the endpoint of role on the channel called name. Returns a handle
+    // passed to the other calls, or NULL on error.
+    void *(*open)(const char *name, LinkLayerRole role);
+    void (*close)(void *handle);
+    // Read up to size bytes, waiting up to timeoutMs milliseconds (a negative
+    // timeout blocks). Returns the number of bytes, 0 on timeout, -1 on error.
+    int (*read)(void *handle, unsigned char *buf, int size, int timeoutMs);
+    // Returns numBytes, or -1 on error.
+    int (*write)(void *handle, const unsigned char *bytes, int numBytes);
+    // Time of the channel, against which the link layer measures timeouts.
+    void (*now)(void *handle, struct timespec *now);
+} TransportBackend;
+
+// Serve the port names "<prefix>:<name>" with backend, which must outlive
+// every transport opened on it. Returns -1 if there is no room left.
+int transportRegister(const char *prefix, const TransportBackend *backend);
+
+// Open the transport selected by the prefix of the port name:
+//   unix:<path>          UNIX stream socket (rx listens, tx connects).
+//   fifo:<path>          Named pipe pair <path>.tx2rx and <path>.rx2tx.
+//   udp:<host>:<port>    UDP datagrams (rx binds, tx sends to host:port).
+//   fd:<n>               Already open descriptor (e.g. one end of a socketpair).
+//   <prefix>:<name>      Channel of a backend registered with transportRegister.
+//   anything else        Serial port (e.g. /dev/ttyS10).
+// Returns NULL on error.
+Transport *transportOpen(const char *portName, int baudRate, LinkLayerRole role);
+
+// Close the transport and release its resources.
+// Returns -1 on error.
+int transportClose(Transport *t);
+
+// Descriptor used for reading (may be used with poll/select); -1 for a
+// registered backend.
+int transportFd(const Transport *t);
+
+// Block until a byte is available (interrupted by signals, e.g. SIGALRM).
+// Returns -1 on error (or closed channel), 0 if no byte was received, 1 if a
+// byte was received.
+int transportReadByte(Transport *t, unsigned char *byte);
+
+// Wait up to timeoutMs milliseconds for a byte (a negative timeout blocks).
+// Returns -1 on error (or closed channel), 0 if no byte was received, 1 if a
+// byte was received.
+int transportReadByteTimeout(Transport *t, unsigned char *byte, int timeoutMs);
+
+// Write numBytes to the transport.
+// Returns -1 on error, otherwise the number of bytes written.
+int transportWriteBytes(Transport *t, const unsigned char *bytes, int numBytes);
+
+// Current time of the transport: the time of a registered backend (e.g. the
+// virtual time of a simulated link), CLOCK_MONOTONIC otherwise. Timeouts are
+// measured against it.
+void transportNow(const Transport *t, struct timespec *now);
+
+#endif // _TRANSPORT_H_
@@ -1,201 +1,826 @@
+#define _GNU_SOURCE // SEEK_DATA / SEEK_HOLE
+
 #include "application_layer.h"
-#include "link_layer.h"
+#include "bonding.h"
+#include "dedup.h"
+#include "file_digest.h"
+#include "link_layer_ctx.h"
+#include "log.h"
+#include "realtime.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 // Definições para o papel do terminal
 #define TRANSMITTER 0
 #define RECEIVER 1
 
-// Tamanho máximo dos dados
-#define MAX_DATA_SIZE 200
+// Códigos de controlo dos pacotes
+#define C_DATA 0x1
+#define C_START 0x2
+#define C_END 0x3
+#define C_HOLE 0x5  // Região só com zeros: C, posição (8 bytes), comprimento (8 bytes)
+#define C_CHUNK 0x6 // Anúncio do bloco que se segue: C, SHA-256, comprimento (2 bytes)
+#define C_REF 0x7   // Bloco já enviado nesta transferência: C, SHA-256, comprimento (2 bytes)
+#define C_REGION 0x8 // Hashes de regiões do ficheiro: C, depois região (8 bytes) e hash truncado de cada
 
-void applicationLayer(const char *serialPort, const char *role, int baudRate,
-                      int nTries, int timeout, const char *filename)
-{
-    // Estrutura para armazenar parâmetros de conexão
-    LinkLayer connectionParameters;
-    strcpy(connectionParameters.serialPort, serialPort);
-    connectionParameters.baudRate = baudRate;
-    connectionParameters.role = (strcmp(role, "tx") == 0) ? TRANSMITTER : RECEIVER;
-    connectionParameters.nRetransmissions = nTries;
-    connectionParameters.timeout = timeout;
+// Tipos dos TLV dos pacotes de controlo
+#define T_FILE_SIZE 0x0
+#define T_SHA256 0x3 // Hash do ficheiro, SHA-256 dos hashes das regiões (só no pacote final)
 
-    // Variáveis para medir o tempo de transmissão
-    struct timeval start, end;
+// Cabeçalho do pacote de dados: C, N, L2, L1
+#define DATA_HEADER_SIZE 4
 
-    printf("Abrir ligação.\n");
-    // Tenta abrir a conexão
-    int fd = llopen(connectionParameters);
-    if (fd < 0)
+// Cabeçalho do pacote de buraco: C, posição, comprimento
+#define HOLE_PACKET_SIZE 17
+
+// Pacote de anúncio / referência de bloco: C, SHA-256, comprimento
+#define CHUNK_PACKET_SIZE (1 + SHA256_SIZE + 2)
+
+// Entrada de um pacote de hashes de regiões: região, hash truncado
+#define REGION_ENTRY_SIZE (8 + DIGEST_REGION_HASH_SIZE)
+
+// Bytes do ficheiro mantidos em memória para escolher o tamanho de cada
+// pacote; cabe sempre um bloco inteiro
+#define READ_BUF_SIZE DEDUP_CHUNK_MAX
+
+// Zeros seguidos a partir dos quais compensa enviar um pacote de buraco
+#define ZERO_RUN_MIN 64
+
+// Nome de ficheiro para o modo contínuo: tx lê do stdin, rx escreve no stdout
+#define STREAM_NAME "-"
+
+// Envia um pacote de controlo com o tamanho do ficheiro (TLV T=0, L=4) e,
+// se hash não for NULL, o SHA-256 do ficheiro (TLV T=3, L=32)
+static int sendControlPacket(ll_ctx *ctx, unsigned char C, unsigned fileSize, const unsigned char *hash)
+{
+    unsigned char buf[7 + 2 + SHA256_SIZE];
+    int size = 7;
+    buf[0] = C;           // Código de controlo (inicial ou final)
+    buf[1] = T_FILE_SIZE; // T: tamanho do ficheiro
+    buf[2] = 0x4;         // L: 4 bytes
+    *((unsigned *)(buf + 3)) = fileSize; // Tamanho do arquivo em bytes
+    if (hash != NULL)
     {
-        perror("Não foi possível estabelecer ligação\n");
-        return; // Retorna caso a conexão não seja bem-sucedida
+        buf[size++] = T_SHA256;
+        buf[size++] = SHA256_SIZE;
+        memcpy(buf + size, hash, SHA256_SIZE);
+        size += SHA256_SIZE;
     }
+    return llwrite_ctx(ctx, buf, size);
+}
 
-    unsigned char buf[512] = {0}; // Buffer para envio e recepção de dados
+// Escreve / lê um campo de 8 bytes (big endian) de um pacote
+static void putUint64(unsigned char *field, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        field[i] = (value >> (56 - 8 * i)) & 0xFF;
+    }
+}
 
-    // Lógica do Transmissor (tx)
-    if (connectionParameters.role == TRANSMITTER)
+static uint64_t getUint64(const unsigned char *field)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
     {
-        // Abre o arquivo para leitura
-        FILE *file = fopen(filename, "r");
+        value = (value << 8) | field[i];
+    }
+    return value;
+}
 
-        if (file == NULL)
+// Hashes de regiões à espera de irem juntos num pacote C_REGION
+typedef struct
+{
+    ll_ctx *ctx;
+    unsigned char buf[MAX_PAYLOAD_SIZE]; // C_REGION seguido das entradas
+    int len;
+    int packets;
+} RegionBatch;
+
+static void flushRegionHashes(RegionBatch *b)
+{
+    if (b->len > 1)
+    {
+        if (llwrite_ctx(b->ctx, b->buf, b->len) < 0)
         {
-            perror("Não foi possível abrir ficheiro\n");
-            exit(-1); // Erro caso a abertura não seja bem-sucedida
+            LOG_ERROR("Transmissão falhou. \n");
+            exit(-1); // Erro caso a transmissão falhe
         }
+        b->packets++;
+    }
+    b->len = 1;
+}
 
-        // Obtem o tamanho do arquivo
-        fseek(file, 0L, SEEK_END);
-        unsigned fileSize = ftell(file);
-        fseek(file, 0L, SEEK_SET);
+// Chamado pelo FileDigest do transmissor com o hash de cada região completa,
+// para o receptor saber que regiões chegaram com erros. Vão tantos por pacote
+// quantos couberem numa trama; as regiões só de buracos não são enviadas.
+static void sendRegionHash(void *user, uint64_t region, const unsigned char *hash)
+{
+    RegionBatch *b = user;
+    if (b->len + REGION_ENTRY_SIZE > (int)sizeof(b->buf))
+    {
+        flushRegionHashes(b);
+    }
+    unsigned char *entry = b->buf + b->len;
+    putUint64(entry, region);
+    memcpy(entry + 8, hash, DIGEST_REGION_HASH_SIZE);
+    int want = b->len - 1 + REGION_ENTRY_SIZE;
+    if (b->len > 1 && llfit_ctx(b->ctx, b->buf, 1, b->buf + 1, want) < want)
+    {
+        // Não cabe: envia as anteriores e esta passa para o início
+        unsigned char copy[REGION_ENTRY_SIZE];
+        memcpy(copy, entry, REGION_ENTRY_SIZE);
+        flushRegionHashes(b);
+        memcpy(b->buf + 1, copy, REGION_ENTRY_SIZE);
+    }
+    b->len += REGION_ENTRY_SIZE;
+}
 
-        // Prepara o pacote de controle inicial
-        int bufSize = 7;
-        unsigned char C = 0x2; // Código de controle para pacote inicial
-        unsigned char T = 0x0; // Tipo de pacote (transmissão inicial)
-        unsigned char L = 0x4; // Tamanho do arquivo
-        buf[0] = C;
-        buf[1] = T;
-        buf[2] = L;
+// Preenche o cabeçalho do pacote de dados número N com len bytes
+static void fillDataHeader(unsigned char *header, unsigned char N, int len)
+{
+    header[0] = C_DATA;
+    header[1] = N;
+    header[2] = len / 256; // L2
+    header[3] = len % 256; // L1
+}
 
-        *((unsigned *)(buf + 3)) = fileSize; // Tamanho do arquivo em bytes
+// Envia um pacote de buraco: length bytes a zero a partir de offset
+static int sendHolePacket(ll_ctx *ctx, off_t offset, off_t length)
+{
+    unsigned char buf[HOLE_PACKET_SIZE];
+    buf[0] = C_HOLE;
+    putUint64(buf + 1, offset);
+    putUint64(buf + 9, length);
+    return llwrite_ctx(ctx, buf, sizeof(buf));
+}
 
-        int bytesSent;
+// Envia o anúncio (C_CHUNK) ou a referência (C_REF) de um bloco
+static int sendChunkPacket(ll_ctx *ctx, unsigned char C, const unsigned char *hash, int length)
+{
+    unsigned char buf[CHUNK_PACKET_SIZE];
+    buf[0] = C;
+    memcpy(buf + 1, hash, SHA256_SIZE);
+    buf[1 + SHA256_SIZE] = length / 256;
+    buf[2 + SHA256_SIZE] = length % 256;
+    return llwrite_ctx(ctx, buf, sizeof(buf));
+}
 
-        gettimeofday(&start, NULL); // Começar a medição de tempo
+// Número de zeros no início de data
+static int leadingZeros(const unsigned char *data, int len)
+{
+    int n = 0;
+    while (n < len && data[n] == 0)
+    {
+        n++;
+    }
+    return n;
+}
 
-        printf("Transmissor: Enviando pacote de controlo inicial. \n");
-        bytesSent = llwrite(buf, bufSize);
-        if (bytesSent < 0)
+// Bytes de data que podem ir em pacotes de dados antes da próxima sequência
+// de pelo menos ZERO_RUN_MIN zeros (que vai num pacote de buraco)
+static int dataBeforeZeroRun(const unsigned char *data, int len)
+{
+    int run = 0;
+    for (int i = 0; i < len; i++)
+    {
+        run = (data[i] == 0) ? run + 1 : 0;
+        if (run == ZERO_RUN_MIN)
         {
-            printf("Transmissão falhou. \n");
-            fclose(file);
-            exit(-1); // Erro caso a transmissão falhe
+            return i + 1 - run;
         }
+    }
+    return len;
+}
+
+// Escolhe quantos bytes de data vão no pacote N: tantos quantos couberem na
+// trama depois do stuffing. O campo de tamanho também pode precisar de
+// stuffing, por isso repete até o tamanho escolhido ser estável.
+static int packetize(ll_ctx *ctx, unsigned char N, const unsigned char *data, int avail)
+{
+    unsigned char header[DATA_HEADER_SIZE];
+    int len = avail;
+    while (TRUE)
+    {
+        fillDataHeader(header, N, len);
+        int fit = llfit_ctx(ctx, header, DATA_HEADER_SIZE, data, len);
+        if (fit >= len)
+        {
+            return len;
+        }
+        len = fit;
+    }
+}
+
+static void transmitFile(ll_ctx *ctx, const char *filename, int baudRate)
+{
+    // Variáveis para medir o tempo de transmissão
+    struct timeval start, end;
+
+    // Abre o arquivo para leitura (ou usa o stdin no modo contínuo)
+    int fd = (strcmp(filename, STREAM_NAME) == 0) ? STDIN_FILENO : open(filename, O_RDONLY);
+
+    if (fd < 0)
+    {
+        perror("Não foi possível abrir ficheiro\n");
+        exit(-1); // Erro caso a abertura não seja bem-sucedida
+    }
+
+    // Obtem o tamanho do arquivo; num pipe só se sabe no fim (vai no pacote final)
+    struct stat st;
+    fstat(fd, &st);
+    int streaming = !S_ISREG(st.st_mode);
+    unsigned fileSize = streaming ? 0 : st.st_size;
+
+    gettimeofday(&start, NULL); // Começar a medição de tempo
+
+    LOG_INFO("Transmissor: Enviando pacote de controlo inicial. \n");
+    if (sendControlPacket(ctx, C_START, fileSize, NULL) < 0)
+    {
+        LOG_ERROR("Transmissão falhou. \n");
+        close(fd);
+        exit(-1); // Erro caso a transmissão falhe
+    }
 
-        // Calcula o número total de pacotes necessários
-        int totalFrames = fileSize / 200 + 1;
+    // Envia os pacotes de dados; cada um leva o máximo que cabe numa trama.
+    // Sequências de zeros (e buracos de ficheiros esparsos) vão em pacotes de buraco.
+    unsigned char data[READ_BUF_SIZE]; // Bytes lidos do ficheiro e ainda não enviados
+    unsigned char buf[MAX_PAYLOAD_SIZE];
+    int avail = 0;
+    int eof = FALSE;
+    off_t pos = 0;          // Posição no ficheiro de data[0]
+    off_t hole = 0;         // Zeros já descartados e ainda por anunciar
+    off_t holeBytes = 0;    // Total de bytes enviados como buracos
+    int chunkLeft = 0;      // Bytes do bloco atual ainda por enviar
+    off_t refBytes = 0;     // Total de bytes enviados como referências
+    unsigned char N = 1;    // Número do pacote
+    int packets = 0;
+    int holes = 0;
+    int refs = 0;
+
+    // Hash do conteúdo, calculado à medida que é enviado
+    FileDigest digest;
+    RegionBatch regions = {.ctx = ctx, .buf = {C_REGION}, .len = 1};
+    digestInit(&digest, sendRegionHash, &regions);
+
+    // Blocos já enviados, tal como o receptor os vai indexar
+    ChunkIndex *index = chunkIndexCreate();
+    if (index == NULL)
+    {
+        LOG_ERROR("Sem memória para o índice de blocos. \n");
+        close(fd);
+        exit(-1);
+    }
+
+    LOG_INFO("Transmissor: Enviando pacotes de dados\n");
+    while (avail > 0 || !eof || hole > 0)
+    {
+        // Buffer vazio: salta os buracos do ficheiro sem os ler
+        if (avail == 0 && !eof)
+        {
+            off_t next = lseek(fd, pos, SEEK_DATA);
+            if (next < 0)
+            {
+                // ENXIO: só há buraco até ao fim; outros erros: sem suporte, lê tudo
+                next = (errno == ENXIO) ? st.st_size : pos;
+            }
+            if (next > pos)
+            {
+                hole += next - pos;
+                pos = next;
+            }
+        }
 
-        // Envia os pacotes de dados
-        C = 0x1;                // Código de controle para pacote de dados
-        unsigned char N = 1;    // Número do pacote
-        unsigned char L2 = 0;   // Tamanho do segundo byte (variável)
-        unsigned char L1 = 200; // Tamanho fixo dos dados
-        buf[0] = C;
-        buf[1] = N;
-        buf[2] = L2;
-        buf[3] = L1;
+        // Mantém o buffer cheio para o packetizer ver os próximos bytes
+        if (!eof && avail < READ_BUF_SIZE)
+        {
+            TRACE_BEGIN("file read");
+            ssize_t n = streaming ? read(fd, data + avail, READ_BUF_SIZE - avail)
+                                  : pread(fd, data + avail, READ_BUF_SIZE - avail, pos + avail);
+            TRACE_END("file read");
+            if (n > 0)
+            {
+                avail += n;
+            }
+            eof = (n <= 0);
+            continue;
+        }
 
-        printf("Transmissor: Enviando pacotes de dados\n");
-        // Loop para o envio dos pacotes
-        while (N < totalFrames)
+        // Zeros no início do buffer: juntam-se ao buraco em curso
+        int zeros = leadingZeros(data, avail);
+        if (zeros == avail && !eof)
         {
-            fread(buf + 4, 1, 200, file);  // Lê os dados do arquivo
-            bytesSent = llwrite(buf, 204); // Envia o pacote
-            if (bytesSent < 0)
+            hole += zeros; // O buffer cheio é só zeros; o buraco pode continuar
+            pos += zeros;
+            avail = 0;
+            continue;
+        }
+        if (hole + zeros >= ZERO_RUN_MIN)
+        {
+            hole += zeros;
+            pos += zeros;
+            memmove(data, data + zeros, avail - zeros);
+            avail -= zeros;
+        }
+        if (hole > 0)
+        {
+            if (sendHolePacket(ctx, pos - hole, hole) < 0)
             {
-                printf("Transmissão falhou. \n");
-                fclose(file);
+                LOG_ERROR("Transmissão falhou. \n");
+                close(fd);
                 exit(-1); // Erro caso a transmissão falhe
             }
-            N++;
-            buf[1] = N; // Atualiza o número do pacote
+            digestUpdate(&digest, NULL, hole);
+            holeBytes += hole;
+            hole = 0;
+            holes++;
+            continue;
         }
-        printf("%d\n", N);
 
-        // Envio do último pacote (com menos de 200 bytes, se necessário)
-        buf[3] = 168;                  // Exemplo de tamanho do último pacote
-        fread(buf + 4, 1, 168, file);  // Lê os dados restantes
-        bytesSent = llwrite(buf, 172); // Envia o último pacote
+        // Início de um bloco: se o receptor já o tem basta a referência, senão é anunciado
+        if (chunkLeft == 0)
+        {
+            TRACE_BEGIN("chunk");
+            int cut = dedupCut(data, dataBeforeZeroRun(data, avail));
+            unsigned char hash[SHA256_SIZE];
+            off_t refOffset;
+            unsigned refLength;
+            if (cut >= DEDUP_CHUNK_MIN)
+            {
+                sha256(data, cut, hash);
+                TRACE_END("chunk");
+                int found = chunkIndexFind(index, hash, &refOffset, &refLength) && refLength == (unsigned)cut;
+                if (!found)
+                {
+                    chunkIndexAdd(index, hash, pos, cut);
+                }
+                if (sendChunkPacket(ctx, found ? C_REF : C_CHUNK, hash, cut) < 0)
+                {
+                    LOG_ERROR("Transmissão falhou. \n");
+                    close(fd);
+                    exit(-1); // Erro caso a transmissão falhe
+                }
+                if (found)
+                {
+                    digestUpdate(&digest, data, cut);
+                    memmove(data, data + cut, avail - cut);
+                    avail -= cut;
+                    pos += cut;
+                    refBytes += cut;
+                    refs++;
+                    continue;
+                }
+            }
+            else
+            {
+                TRACE_END("chunk");
+            }
+            chunkLeft = cut; // Blocos pequenos vão como dados, sem anúncio
+        }
 
-        printf("Transmissor: Enviando pacote de controlo final.\n");
+        TRACE_BEGIN("packetize");
+        int len = packetize(ctx, N, data, chunkLeft);
+        TRACE_END("packetize");
+        if (len <= 0)
+        {
+            LOG_ERROR("Trama demasiado pequena para o cabeçalho do pacote. \n");
+            close(fd);
+            exit(-1);
+        }
 
-        if (bytesSent < 0)
+        fillDataHeader(buf, N, len);
+        memcpy(buf + DATA_HEADER_SIZE, data, len);
+        if (llwrite_ctx(ctx, buf, DATA_HEADER_SIZE + len) < 0)
         {
-            printf("Transmissão falhou. \n");
-            fclose(file);
+            LOG_ERROR("Transmissão falhou. \n");
+            close(fd);
             exit(-1); // Erro caso a transmissão falhe
         }
 
-        // Envio do pacote de controle final
-        C = 0x3; // Código de controle para pacote final
-        buf[0] = C;
-        buf[1] = T;
-        buf[2] = L;
+        digestUpdate(&digest, data, len);
+        memmove(data, data + len, avail - len);
+        avail -= len;
+        pos += len;
+        chunkLeft -= len;
+        N++;
+        packets++;
+    }
+    LOG_DEBUG("%d\n", packets);
+
+    // Envio do pacote de controle final, com o tamanho enviado e o hash do ficheiro
+    // (o TLV só tem 4 bytes; a partir de 4 GiB as posições vão nos buracos)
+    fileSize = pos;
+    unsigned char fileHash[SHA256_SIZE];
+    digestFinal(&digest, fileHash);
+    flushRegionHashes(&regions);
+    LOG_DEBUG("Transmissor: %d pacotes de hashes de regiões.\n", regions.packets);
+    LOG_INFO("Transmissor: Enviando pacote de controlo final.\n");
+    if (sendControlPacket(ctx, C_END, fileSize, fileHash) < 0)
+    {
+        LOG_ERROR("Transmissão falhou. \n");
+        close(fd);
+        exit(-1); // Erro caso a transmissão falhe
+    }
 
-        *((unsigned *)(buf + 3)) = fileSize; // Tamanho do arquivo em bytes
+    close(fd); // Fecha o arquivo
+    chunkIndexDestroy(index);
+    LOG_INFO("Transmissor: Dados enviados com sucesso\n");
+
+    gettimeofday(&end, NULL); // Finaliza a medição de tempo
+
+    llclose_ctx(ctx, 1);
+    LOG_INFO("Transmissor: Fechar ligação.\n");
+
+    // Cálculo de estatísticas de transmissão
+    double total_bits_received = pos * 8.0; // Tamanho do arquivo em bits
+    double C_baud = baudRate;
+
+    double transfer_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+    double R = total_bits_received / transfer_time; // Taxa de bits recebidos
+    double S = R / C_baud;                          // Eficiência da transmissão
+
+    // Impressão das estatísticas
+    logFlush();
+    printf("Número de bits enviados: %.0f \n", total_bits_received);
+    printf("Pacotes de dados: %d (média de %.1f bytes por pacote)\n", packets, packets ? (double)(pos - holeBytes - refBytes) / packets : 0.0);
+    printf("Bytes a zero não enviados: %lld (%d pacotes de buraco)\n", (long long)holeBytes, holes);
+    printf("Blocos repetidos: %d (%lld bytes enviados como referência)\n", refs, (long long)refBytes);
+    printf("Capacidade da ligação: %.0f bits/s \n", C_baud);
+    printf("Duração da transmissão: %.3f segundos\n", transfer_time);
+    printf("Bitrate recebido (R): %.3f bits/s\n", R);
+    printf("Eficiência (S): %.3f\n", S);
+}
 
-        bytesSent = llwrite(buf, bufSize);
+// Lê para chunk (com DEDUP_CHUNK_MAX bytes) um bloco já recebido
+static int readChunk(FILE *file, const ChunkIndex *index, const unsigned char *hash, unsigned length, unsigned char *chunk)
+{
+    off_t offset;
+    unsigned found;
+    if (!chunkIndexFind(index, hash, &offset, &found) || found != length || length > DEDUP_CHUNK_MAX)
+    {
+        return -1;
+    }
+    fflush(file); // O bloco pode ainda estar no buffer do stdio
+    if (pread(fileno(file), chunk, length, offset) != (ssize_t)length)
+    {
+        return -1;
+    }
+    return 0;
+}
 
-        fseek(file, 0L, SEEK_SET);
-        fclose(file); // Fecha o arquivo
-        printf("Transmissor: Dados enviados com sucesso\n");
+// Hashes por região: os calculados pelo receptor e os enviados pelo transmissor
+typedef struct
+{
+    unsigned char (*hashes)[DIGEST_REGION_HASH_SIZE];
+    unsigned char *present;
+    uint64_t capacity;
+} RegionHashes;
 
-        gettimeofday(&end, NULL); // Finaliza a medição de tempo
+static void storeRegionHash(RegionHashes *r, uint64_t region, const unsigned char *hash)
+{
+    if (region >= r->capacity)
+    {
+        uint64_t capacity = r->capacity ? r->capacity : 64;
+        while (capacity <= region)
+        {
+            capacity *= 2;
+        }
+        void *hashes = realloc(r->hashes, (size_t)capacity * DIGEST_REGION_HASH_SIZE);
+        unsigned char *present = realloc(r->present, capacity);
+        if (hashes == NULL || present == NULL)
+        {
+            LOG_ERROR("Sem memória para os hashes das regiões. \n");
+            exit(-1);
+        }
+        memset(present + r->capacity, 0, capacity - r->capacity);
+        r->hashes = hashes;
+        r->present = present;
+        r->capacity = capacity;
+    }
+    memcpy(r->hashes[region], hash, DIGEST_REGION_HASH_SIZE);
+    r->present[region] = 1;
+}
 
-        llclose(1);
-        printf("Transmissor: Fechar ligação.\n");
+// Chamado pelo FileDigest do receptor
+static void storeComputedRegion(void *user, uint64_t region, const unsigned char *hash)
+{
+    storeRegionHash(user, region, hash);
+}
 
-        // Cálculo de estatísticas de transmissão
-        double total_bits_received = 87744; // Tamanho do arquivo em bits
-        double C_baud = connectionParameters.baudRate;
+// Compara o hash recebido no pacote final e, se falhar, indica as regiões com erros
+static void verifyFile(FileDigest *digest, const unsigned char *expected, RegionHashes *computed, RegionHashes *received)
+{
+    unsigned char hash[SHA256_SIZE];
+    digestFinal(digest, hash);
+    logFlush();
+    if (expected == NULL)
+    {
+        printf("Receptor: Transmissor não enviou hash; ficheiro não verificado.\n");
+        return;
+    }
+    if (memcmp(hash, expected, SHA256_SIZE) == 0)
+    {
+        printf("Receptor: SHA-256 do ficheiro verificado.\n");
+        return;
+    }
 
-        double transfer_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
-        double R = total_bits_received / transfer_time; // Taxa de bits recebidos
-        double S = R / C_baud;                          // Eficiência da transmissão
+    printf("Receptor: SHA-256 do ficheiro NÃO corresponde. Regiões a pedir de novo:\n");
+    // Uma região só de buracos não tem hash em nenhum dos lados
+    uint64_t n = computed->capacity > received->capacity ? computed->capacity : received->capacity;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        int mine = i < computed->capacity && computed->present[i];
+        int theirs = i < received->capacity && received->present[i];
+        if (mine != theirs || (mine && memcmp(computed->hashes[i], received->hashes[i], DIGEST_REGION_HASH_SIZE) != 0))
+        {
+            printf("  bytes %llu-%llu\n", (unsigned long long)(i * DIGEST_REGION_SIZE),
+                   (unsigned long long)((i + 1) * DIGEST_REGION_SIZE - 1));
+        }
+    }
+}
 
-        // Impressão das estatísticas
-        printf("Número de bits enviados: %.0f \n", total_bits_received);
-        printf("Capacidade da ligação: %.0f bits/s \n", C_baud);
-        printf("Duração da transmissão: %.3f segundos\n", transfer_time);
-        printf("Bitrate recebido (R): %.3f bits/s\n", R);
-        printf("Eficiência (S): %.3f\n", S);
+// Avança length bytes a zero no ficheiro de saída. Num ficheiro normal basta
+// saltar (o sistema de ficheiros deixa um buraco); senão escreve os zeros.
+static void skipHole(FILE *file, off_t length)
+{
+    if (fseeko(file, length, SEEK_CUR) == 0)
+    {
+        return;
     }
-    // Lógica do Receptor (rx)
-    else if (connectionParameters.role == RECEIVER)
+    static const unsigned char zeros[READ_BUF_SIZE];
+    while (length > 0)
+    {
+        size_t n = length < (off_t)sizeof(zeros) ? (size_t)length : sizeof(zeros);
+        fwrite(zeros, 1, n, file);
+        length -= n;
+    }
+}
+
+// outFd: descritor onde escrever no modo contínuo, ou -1 para usar filename
+static void receiveFile(ll_ctx *ctx, const char *filename, int outFd)
+{
+    int data_read = 1;
+    unsigned char buf[MAX_PAYLOAD_SIZE];
+    unsigned char seq = 1; // Número do próximo pacote esperado
+    off_t written = 0;     // Bytes do ficheiro já escritos (ou saltados)
+    int bytesRead;
+    unsigned char chunk[DEDUP_CHUNK_MAX];
+    unsigned char expected[SHA256_SIZE]; // Hash do ficheiro no pacote final
+    int hasExpected = FALSE;
+
+    // Hash do conteúdo à medida que é escrito
+    RegionHashes computed = {0}, received = {0};
+    FileDigest digest;
+    digestInit(&digest, storeComputedRegion, &computed);
+
+    // Abre um arquivo para gravação (e leitura, para copiar blocos repetidos)
+    FILE *new = (outFd >= 0) ? fdopen(outFd, "w") : fopen(filename, "w+");
+    if (new == NULL)
+    {
+        perror("Não foi possível abrir ficheiro\n");
+        exit(-1);
+    }
+
+    // O stdout não pode ser relido: os blocos anunciados ficam numa cópia temporária
+    FILE *store = new;
+    unsigned chunkLeft = 0; // Bytes do bloco anunciado ainda por copiar para store
+    if (outFd >= 0)
     {
-        int data_read = 1;
-        unsigned char buf[512];
-        int seq; // Variável para número do pacote
-        int bytesRead;
+        store = tmpfile();
+        if (store == NULL)
+        {
+            perror("tmpfile");
+            exit(-1);
+        }
+    }
 
-        // Abre um arquivo para gravação
-        FILE *new = fopen(filename, "w");
-        fseek(new, 0L, SEEK_SET);
+    // Blocos anunciados pelo transmissor e onde ficaram no ficheiro
+    ChunkIndex *index = chunkIndexCreate();
+    if (index == NULL)
+    {
+        LOG_ERROR("Sem memória para o índice de blocos. \n");
+        exit(-1);
+    }
 
-        // Enquanto não receber pacote de controle final (3)
-        while (data_read)
+    // Enquanto não receber pacote de controle final (3)
+    while (data_read)
+    {
+        bytesRead = llread_ctx(ctx, buf); // Lê um pacote
+        if (bytesRead <= 0)
+        {
+            if (llbroken_ctx(ctx))
+            {
+                LOG_ERROR("Receptor: Ligação interrompida. \n");
+                break;
+            }
+            continue;
+        }
+
+        // Pacote de controle inicial
+        if (buf[0] == C_START)
+        {
+            LOG_INFO("Receptor: Recebido pacote de controlo inicial. \n");
+        }
+        // Pacote de dados: a ligação entrega-os por ordem e sem repetições
+        if (buf[0] == C_DATA)
         {
-            bytesRead = llread(buf); // Lê um pacote
-            // Pacote de controle inicial
-            if (bytesRead > 0 && buf[0] == 0x2)
+            int len = (bytesRead >= DATA_HEADER_SIZE) ? buf[2] * 256 + buf[3] : -1;
+            if (len < 0 || len > bytesRead - DATA_HEADER_SIZE)
             {
-                printf("Receptor: Recebido pacote de controlo inicial. \n");
+                LOG_WARN("Receptor: Pacote de dados inválido (%d bytes), ignorado.\n", bytesRead);
+                continue;
             }
-            // Pacote de dados
-            if (bytesRead > 0 && buf[0] == 0x1)
+            if (buf[1] != seq)
             {
-                fseek(new, (buf[1] - 1) * 200, SEEK_SET);       // Define a posição do próximo byte
-                fwrite(buf + 4, 1, buf[2] * 256 + buf[3], new); // Escreve os dados no arquivo
-                seq = buf[1];                                   // Armazena o número do pacote recebido
-                printf("Receptor: Recebido pacote de dados  %d.\n", seq);
+                LOG_WARN("Receptor: Esperado pacote %d, recebido %d.\n", seq, buf[1]);
             }
-            // Pacote de controle final
-            if (bytesRead > 0 && buf[0] == 0x3)
+            TRACE_BEGIN("file write");
+            fwrite(buf + DATA_HEADER_SIZE, 1, len, new); // Escreve os dados no arquivo
+            TRACE_END("file write");
+            if (store != new && chunkLeft > 0)
             {
-                printf("Receptor: Recebido pacote de controlo final. \n");
-                data_read = 0; // Termina o loop
+                unsigned n = (unsigned)len < chunkLeft ? (unsigned)len : chunkLeft;
+                fwrite(buf + DATA_HEADER_SIZE, 1, n, store);
+                chunkLeft -= n;
             }
+            digestUpdate(&digest, buf + DATA_HEADER_SIZE, len);
+            written += len;
+            LOG_DEBUG("Receptor: Recebido pacote de dados  %d.\n", buf[1]);
+            seq = buf[1] + 1;
         }
+        // Pacote de buraco: a região só tem zeros
+        if (buf[0] == C_HOLE)
+        {
+            if (bytesRead < HOLE_PACKET_SIZE)
+            {
+                LOG_WARN("Receptor: Pacote de buraco truncado, ignorado.\n");
+                continue;
+            }
+            off_t offset = getUint64(buf + 1);
+            off_t length = getUint64(buf + 9);
+            if (length < 0)
+            {
+                LOG_WARN("Receptor: Buraco com tamanho inválido, ignorado.\n");
+                continue;
+            }
+            if (offset != written)
+            {
+                LOG_WARN("Receptor: Buraco na posição %lld, esperada %lld.\n", (long long)offset, (long long)written);
+            }
+            skipHole(new, length);
+            digestUpdate(&digest, NULL, length);
+            written += length;
+            LOG_DEBUG("Receptor: Recebido buraco de %lld bytes.\n", (long long)length);
+        }
+        // Anúncio de bloco: os dados que se seguem ficam no índice
+        if ((buf[0] == C_CHUNK || buf[0] == C_REF) && bytesRead < CHUNK_PACKET_SIZE)
+        {
+            LOG_WARN("Receptor: Pacote de bloco truncado, ignorado.\n");
+            continue;
+        }
+        if (buf[0] == C_CHUNK)
+        {
+            unsigned length = buf[1 + SHA256_SIZE] * 256 + buf[2 + SHA256_SIZE];
+            if (store == new)
+            {
+                chunkIndexAdd(index, buf + 1, written, length);
+            }
+            else
+            {
+                chunkIndexAdd(index, buf + 1, ftello(store), length);
+                chunkLeft = length;
+            }
+        }
+        // Referência: bloco já recebido, copiado do próprio ficheiro
+        if (buf[0] == C_REF)
+        {
+            unsigned length = buf[1 + SHA256_SIZE] * 256 + buf[2 + SHA256_SIZE];
+            if (readChunk(store, index, buf + 1, length, chunk) == 0)
+            {
+                fwrite(chunk, 1, length, new);
+                digestUpdate(&digest, chunk, length);
+            }
+            else
+            {
+                LOG_ERROR("Receptor: Bloco referenciado desconhecido.\n");
+                skipHole(new, length);
+                digestUpdate(&digest, NULL, length);
+            }
+            written += length;
+            LOG_DEBUG("Receptor: Recebida referência a bloco de %u bytes.\n", length);
+        }
+        // Hashes de regiões calculados pelo transmissor
+        if (buf[0] == C_REGION)
+        {
+            if ((bytesRead - 1) % REGION_ENTRY_SIZE != 0)
+            {
+                LOG_WARN("Receptor: Pacote de hashes de regiões truncado, ignorado.\n");
+                continue;
+            }
+            for (int i = 1; i < bytesRead; i += REGION_ENTRY_SIZE)
+            {
+                storeRegionHash(&received, getUint64(buf + i), buf + i + 8);
+            }
+        }
+        // Pacote de controle final
+        if (buf[0] == C_END)
+        {
+            LOG_INFO("Receptor: Recebido pacote de controlo final. \n");
+            // Percorre os TLV à procura do hash do ficheiro
+            for (int i = 1; i + 2 <= bytesRead && i + 2 + buf[i + 1] <= bytesRead; i += 2 + buf[i + 1])
+            {
+                if (buf[i] == T_SHA256 && buf[i + 1] == SHA256_SIZE)
+                {
+                    memcpy(expected, buf + i + 2, SHA256_SIZE);
+                    hasExpected = TRUE;
+                }
+            }
+            data_read = 0; // Termina o loop
+        }
+    }
+
+    // Um buraco no fim só foi saltado; fixa o tamanho final do ficheiro
+    fflush(new);
+    if (ftello(new) >= 0 && ftruncate(fileno(new), written) < 0)
+    {
+        perror("ftruncate");
+    }
+    fclose(new); // Fecha o arquivo
+    if (store != new)
+    {
+        fclose(store);
+    }
+    chunkIndexDestroy(index);
 
-        fseek(new, 0L, SEEK_SET);
-        fclose(new); // Fecha o arquivo
-        llclose(1);  // Fecha a conexão
-        printf("Receptor: Fechar ligação\n");
+    if (data_read == 0)
+    {
+        verifyFile(&digest, hasExpected ? expected : NULL, &computed, &received);
+    }
+    free(computed.hashes);
+    free(computed.present);
+    free(received.hashes);
+    free(received.present);
+
+    llclose_ctx(ctx, 1); // Fecha a conexão
+    LOG_INFO("Receptor: Fechar ligação\n");
+}
+
+void applicationLayer(const char *serialPort, const char *role, int baudRate,
+                      int nTries, int timeout, const char *filename)
+{
+    // Modo de tempo real e trace de eventos (opcionais, escolhidos pelo ambiente)
+    rtSetup();
+    traceInit(role);
+
+    // Lista de portas separadas por vírgulas: transferência agregada por várias ligações
+    if (strchr(serialPort, ',') != NULL)
+    {
+        bondedApplicationLayer(serialPort, role, baudRate, nTries, timeout, filename);
+        return;
+    }
+
+    // Estrutura para armazenar parâmetros de conexão
+    LinkLayer connectionParameters;
+    strcpy(connectionParameters.serialPort, serialPort);
+    connectionParameters.baudRate = baudRate;
+    connectionParameters.role = (strcmp(role, "tx") == 0) ? TRANSMITTER : RECEIVER;
+    connectionParameters.nRetransmissions = nTries;
+    connectionParameters.timeout = timeout;
+
+    // Modo contínuo no receptor: o stdout passa a levar só os dados do ficheiro
+    // e as mensagens (incluindo as que ainda estão no buffer) vão para o stderr
+    int outFd = -1;
+    if (connectionParameters.role == RECEIVER && strcmp(filename, STREAM_NAME) == 0)
+    {
+        outFd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
+    LOG_INFO("Abrir ligação.\n");
+    // Tenta abrir a conexão
+    ll_ctx *ctx = llopen_ctx(connectionParameters);
+    if (ctx == NULL)
+    {
+        perror("Não foi possível estabelecer ligação\n");
+        return; // Retorna caso a conexão não seja bem-sucedida
+    }
+
+    // Lógica do Transmissor (tx)
+    if (connectionParameters.role == TRANSMITTER)
+    {
+        transmitFile(ctx, filename, baudRate);
+    }
+    // Lógica do Receptor (rx)
+    else if (connectionParameters.role == RECEIVER)
+    {
+        receiveFile(ctx, filename, outFd);
     }
 }
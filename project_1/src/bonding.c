@@ -0,0 +1,514 @@
+#include "bonding.h"
+#include "link_layer_ctx.h"
+#include "log.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Códigos de controlo dos pacotes
+#define C_START 0x2
+#define C_END 0x3
+#define C_DATA_OFFSET 0x4 // Pacote de dados com posição absoluta no ficheiro
+
+// Cabeçalho do pacote de dados: C, posição (4 bytes), L2, L1
+#define DATA_HEADER_SIZE 7
+
+// Dados num pacote no máximo; cada ligação usa tantos quantos couberem nas suas tramas
+#define MAX_CHUNK_DATA (MAX_PAYLOAD_SIZE - DATA_HEADER_SIZE)
+
+// Intervalo de bytes do ficheiro [start, end)
+typedef struct
+{
+    unsigned start;
+    unsigned end;
+} Range;
+
+// Estado partilhado por todas as ligações do grupo
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // Bloco devolvido ou entregue (acorda as ligações em espera)
+    int fd;             // Ficheiro a enviar / receber
+    unsigned fileSize;  // Tamanho do ficheiro
+
+    // Transmissor
+    unsigned nextOffset;             // Início da parte ainda não atribuída
+    Range requeued[MAX_BOND_LINKS];  // Blocos devolvidos por ligações que falharam
+    int nRequeued;
+    unsigned inFlight;               // Blocos atribuídos ainda sem ACK
+
+    // Receptor: o ficheiro está completo quando os intervalos recebidos (por
+    // qualquer ligação) cobrem o tamanho anunciado no C_START
+    int sizeKnown;
+    Range *received;    // Ordenados e disjuntos
+    int nReceived;
+    int receivedCapacity;
+    unsigned receivedBytes;
+    atomic_int complete; // As ligações paradas deixam de esperar (LlOptions.cancel)
+} Bond;
+
+// Estado de cada ligação do grupo
+typedef struct
+{
+    Bond *bond;
+    LinkLayer params;
+    unsigned chunks;    // Blocos enviados / recebidos nesta ligação
+    unsigned bytes;     // Bytes de dados enviados / recebidos
+    int active;         // Ligação aberta e a funcionar
+    double byteTime;    // Média móvel do tempo por byte até ao ACK (segundos)
+    double elapsed;     // Duração da ligação (segundos)
+} BondLink;
+
+static BondLink links[MAX_BOND_LINKS];
+static int nBondLinks;
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Pacote de controlo com o tamanho do ficheiro (TLV T=0, L=4)
+static int sendControlPacket(ll_ctx *ctx, unsigned char C, unsigned fileSize)
+{
+    unsigned char buf[7] = {C, 0x0, 0x4};
+    *((unsigned *)(buf + 3)) = fileSize;
+    return llwrite_ctx(ctx, buf, sizeof(buf));
+}
+
+// Preenche o cabeçalho do pacote de dados com len bytes a partir de offset
+static void fillDataHeader(unsigned char *header, unsigned offset, int len)
+{
+    header[0] = C_DATA_OFFSET;
+    header[1] = (offset >> 24) & 0xFF;
+    header[2] = (offset >> 16) & 0xFF;
+    header[3] = (offset >> 8) & 0xFF;
+    header[4] = offset & 0xFF;
+    header[5] = len / 256;
+    header[6] = len % 256;
+}
+
+// Quantos dos avail bytes em buf + DATA_HEADER_SIZE cabem numa trama desta
+// ligação depois do stuffing (o campo de tamanho também conta, por isso
+// repete até o tamanho ser estável), com o cabeçalho já preenchido
+static int packetize(ll_ctx *ctx, unsigned char *buf, unsigned offset, int avail)
+{
+    int len = avail;
+    while (TRUE)
+    {
+        fillDataHeader(buf, offset, len);
+        int fit = llfit_ctx(ctx, buf, DATA_HEADER_SIZE, buf + DATA_HEADER_SIZE, len);
+        if (fit >= len)
+        {
+            return len;
+        }
+        len = fit > 0 ? fit : 0;
+    }
+}
+
+// Lê para buf o próximo bloco da ligação "self" e devolve o seu tamanho, ou
+// -1 se não houver mais. Cada bloco leva tantos bytes quantos couberem numa
+// trama da ligação. Os blocos são atribuídos ao ritmo dos ACKs de cada
+// ligação: uma ligação só aceita um bloco se o conseguir entregar antes de a
+// ligação mais rápida despachar todos os bytes que faltam, para que uma
+// linha lenta não atrase o fim. Uma ligação que recusa fica à espera
+// enquanto houver blocos por confirmar noutras ligações: se uma delas
+// falhar, o bloco devolvido volta a ser distribuído e pode calhar-lhe a ela.
+static int takeChunk(BondLink *self, ll_ctx *ctx, unsigned char *buf, unsigned *offset)
+{
+    Bond *bond = self->bond;
+    int len = -1;
+
+    pthread_mutex_lock(&bond->lock);
+    while (TRUE)
+    {
+        unsigned remaining = bond->fileSize - bond->nextOffset;
+        for (int i = 0; i < bond->nRequeued; i++)
+        {
+            remaining += bond->requeued[i].end - bond->requeued[i].start;
+        }
+        if (remaining == 0 && bond->inFlight == 0)
+        {
+            break; // Tudo entregue
+        }
+        if (remaining > 0)
+        {
+            // Primeiro os blocos devolvidos
+            Range *r = (bond->nRequeued > 0) ? &bond->requeued[bond->nRequeued - 1] : NULL;
+            *offset = (r != NULL) ? r->start : bond->nextOffset;
+            unsigned avail = ((r != NULL) ? r->end : bond->fileSize) - *offset;
+            if (avail > MAX_CHUNK_DATA)
+            {
+                avail = MAX_CHUNK_DATA;
+            }
+            int n = pread(bond->fd, buf + DATA_HEADER_SIZE, avail, *offset);
+            if (n <= 0)
+            {
+                perror("pread");
+                exit(-1);
+            }
+            n = packetize(ctx, buf, *offset, n);
+
+            double best = self->byteTime;
+            for (int i = 0; i < nBondLinks; i++)
+            {
+                if (links[i].active && links[i].byteTime > 0 && (best == 0 || links[i].byteTime < best))
+                {
+                    best = links[i].byteTime;
+                }
+            }
+            if (n > 0 && (self->byteTime == 0 || self->byteTime * n <= best * remaining))
+            {
+                if (r != NULL)
+                {
+                    r->start += n;
+                    if (r->start == r->end)
+                    {
+                        bond->nRequeued--;
+                    }
+                }
+                else
+                {
+                    bond->nextOffset += n;
+                }
+                bond->inFlight++;
+                len = n;
+                break;
+            }
+        }
+        pthread_cond_wait(&bond->changed, &bond->lock);
+    }
+    pthread_mutex_unlock(&bond->lock);
+    return len;
+}
+
+static void *transmitterLink(void *arg)
+{
+    BondLink *self = arg;
+    Bond *bond = self->bond;
+    unsigned char buf[DATA_HEADER_SIZE + MAX_CHUNK_DATA];
+
+    ll_ctx *ctx = llopen_ctx(self->params);
+    if (ctx == NULL)
+    {
+        LOG_WARN("Ligação %s: não foi possível estabelecer ligação\n", self->params.serialPort);
+        return NULL; // As outras ligações ficam com os blocos
+    }
+
+    pthread_mutex_lock(&bond->lock);
+    self->active = 1;
+    pthread_mutex_unlock(&bond->lock);
+
+    double start = now();
+    if (sendControlPacket(ctx, C_START, bond->fileSize) < 0)
+    {
+        LOG_WARN("Ligação %s falhou no início\n", self->params.serialPort);
+        pthread_mutex_lock(&bond->lock);
+        self->active = 0;
+        pthread_cond_broadcast(&bond->changed);
+        pthread_mutex_unlock(&bond->lock);
+        llclose_ctx(ctx, 0);
+        return NULL;
+    }
+
+    int failed = FALSE;
+    unsigned offset;
+    int len;
+    while ((len = takeChunk(self, ctx, buf, &offset)) >= 0)
+    {
+        double t0 = now();
+        if (llwrite_ctx(ctx, buf, DATA_HEADER_SIZE + len) < 0)
+        {
+            // Devolve o bloco: sem ACK não sabemos se chegou, reenviá-lo noutra ligação é seguro
+            LOG_WARN("Ligação %s falhou, %d bytes na posição %u reatribuídos\n", self->params.serialPort, len, offset);
+            pthread_mutex_lock(&bond->lock);
+            bond->requeued[bond->nRequeued++] = (Range){offset, offset + len};
+            bond->inFlight--;
+            self->active = 0;
+            pthread_cond_broadcast(&bond->changed);
+            pthread_mutex_unlock(&bond->lock);
+            failed = TRUE;
+            break;
+        }
+        double dt = now() - t0;
+
+        pthread_mutex_lock(&bond->lock);
+        if (len > 0)
+        {
+            self->byteTime = (self->byteTime == 0) ? dt / len : 0.8 * self->byteTime + 0.2 * dt / len;
+        }
+        bond->inFlight--;
+        pthread_cond_broadcast(&bond->changed);
+        pthread_mutex_unlock(&bond->lock);
+        self->chunks++;
+        self->bytes += len;
+    }
+
+    // Numa ligação que falhou o C_END também falharia; o receptor termina
+    // quando tem o ficheiro completo, mesmo sem o C_END desta ligação
+    if (!failed && sendControlPacket(ctx, C_END, bond->fileSize) < 0)
+    {
+        LOG_WARN("Ligação %s: falhou o envio do pacote de controlo final\n", self->params.serialPort);
+    }
+    self->elapsed = now() - start;
+    llclose_ctx(ctx, 0);
+    return NULL;
+}
+
+// Junta [start, end) aos intervalos recebidos e verifica se o ficheiro ficou
+// completo. Um bloco repetido (reenviado depois de um ACK perdido) não conta
+// duas vezes.
+static void addReceived(Bond *bond, unsigned start, unsigned end)
+{
+    pthread_mutex_lock(&bond->lock);
+    if (start < end)
+    {
+        // Intervalos i..j-1 tocam em [start, end)
+        int i = 0;
+        while (i < bond->nReceived && bond->received[i].end < start)
+        {
+            i++;
+        }
+        int j = i;
+        unsigned covered = 0;
+        while (j < bond->nReceived && bond->received[j].start <= end)
+        {
+            unsigned a = bond->received[j].start > start ? bond->received[j].start : start;
+            unsigned b = bond->received[j].end < end ? bond->received[j].end : end;
+            covered += (b > a) ? b - a : 0;
+            j++;
+        }
+        bond->receivedBytes += (end - start) - covered;
+
+        Range merged = {start, end};
+        if (j > i)
+        {
+            merged.start = bond->received[i].start < start ? bond->received[i].start : start;
+            merged.end = bond->received[j - 1].end > end ? bond->received[j - 1].end : end;
+        }
+        else if (bond->nReceived == bond->receivedCapacity)
+        {
+            int capacity = bond->receivedCapacity ? 2 * bond->receivedCapacity : 16;
+            Range *received = realloc(bond->received, capacity * sizeof(Range));
+            if (received == NULL)
+            {
+                perror("realloc");
+                exit(-1);
+            }
+            bond->received = received;
+            bond->receivedCapacity = capacity;
+        }
+        // Substitui i..j-1 (ou insere em i) pelo intervalo junto
+        memmove(&bond->received[i + 1], &bond->received[j], (bond->nReceived - j) * sizeof(Range));
+        bond->received[i] = merged;
+        bond->nReceived += 1 - (j - i);
+    }
+    if (bond->sizeKnown && bond->receivedBytes >= bond->fileSize && !atomic_load(&bond->complete))
+    {
+        LOG_INFO("Ficheiro completo (%u bytes)\n", bond->fileSize);
+        atomic_store(&bond->complete, TRUE);
+    }
+    pthread_mutex_unlock(&bond->lock);
+}
+
+static void *receiverLink(void *arg)
+{
+    BondLink *self = arg;
+    Bond *bond = self->bond;
+    unsigned char buf[MAX_PAYLOAD_SIZE];
+
+    // Uma ligação parada desiste quando as outras tiverem completado o ficheiro
+    LlOptions options;
+    lldefaultoptions(&options);
+    options.cancel = &bond->complete;
+
+    ll_ctx *ctx = llopen_ctx_opts(self->params, &options);
+    if (ctx == NULL)
+    {
+        if (!atomic_load(&bond->complete))
+        {
+            LOG_WARN("Ligação %s: não foi possível estabelecer ligação\n", self->params.serialPort);
+        }
+        return NULL;
+    }
+
+    double start = now();
+    int data_read = 1;
+    while (data_read)
+    {
+        int bytesRead = llread_ctx(ctx, buf);
+        if (bytesRead <= 0)
+        {
+            if (llbroken_ctx(ctx))
+            {
+                if (!atomic_load(&bond->complete))
+                {
+                    LOG_WARN("Ligação %s: canal fechado\n", self->params.serialPort);
+                }
+                break;
+            }
+            continue;
+        }
+
+        switch (buf[0])
+        {
+        case C_START:
+            if (bytesRead < 7)
+            {
+                LOG_WARN("Ligação %s: pacote de controlo truncado\n", self->params.serialPort);
+                break;
+            }
+            pthread_mutex_lock(&bond->lock);
+            bond->fileSize = *((unsigned *)(buf + 3));
+            bond->sizeKnown = TRUE;
+            pthread_mutex_unlock(&bond->lock);
+            addReceived(bond, 0, 0); // Um ficheiro vazio já está completo
+            break;
+        case C_DATA_OFFSET:
+        {
+            if (bytesRead < DATA_HEADER_SIZE)
+            {
+                LOG_WARN("Ligação %s: pacote de dados truncado\n", self->params.serialPort);
+                break;
+            }
+            unsigned offset = (buf[1] << 24) | (buf[2] << 16) | (buf[3] << 8) | buf[4];
+            int len = buf[5] * 256 + buf[6];
+            if (len > bytesRead - DATA_HEADER_SIZE)
+            {
+                LOG_WARN("Ligação %s: pacote de dados com tamanho inválido (%d de %d bytes)\n",
+                         self->params.serialPort, len, bytesRead - DATA_HEADER_SIZE);
+                break;
+            }
+            if (pwrite(bond->fd, buf + DATA_HEADER_SIZE, len, offset) != len)
+            {
+                perror("pwrite");
+            }
+            self->chunks++;
+            self->bytes += len;
+            addReceived(bond, offset, offset + len);
+            break;
+        }
+        case C_END:
+            data_read = 0;
+            break;
+        default:
+            break;
+        }
+    }
+
+    self->elapsed = now() - start;
+    llclose_ctx(ctx, 0);
+    return NULL;
+}
+
+// Separa a lista de portas e prepara os parâmetros de cada ligação
+static int parsePorts(const char *serialPorts, LinkLayerRole role, int baudRate, int nTries, int timeout, Bond *bond)
+{
+    int n = 0;
+    const char *p = serialPorts;
+    while (*p != '\0' && n < MAX_BOND_LINKS)
+    {
+        size_t len = strcspn(p, ",");
+        if (len > 0 && len < sizeof(links[n].params.serialPort))
+        {
+            memset(&links[n], 0, sizeof(BondLink));
+            memcpy(links[n].params.serialPort, p, len);
+            links[n].params.serialPort[len] = '\0';
+            links[n].params.role = role;
+            links[n].params.baudRate = baudRate;
+            links[n].params.nRetransmissions = nTries;
+            links[n].params.timeout = timeout;
+            links[n].bond = bond;
+            n++;
+        }
+        p += len;
+        if (*p == ',')
+        {
+            p++;
+        }
+    }
+    return n;
+}
+
+int bondedApplicationLayer(const char *serialPorts, const char *role, int baudRate,
+                           int nTries, int timeout, const char *filename)
+{
+    Bond bond = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+    LinkLayerRole llRole = (strcmp(role, "tx") == 0) ? LlTx : LlRx;
+
+    nBondLinks = parsePorts(serialPorts, llRole, baudRate, nTries, timeout, &bond);
+    if (nBondLinks == 0)
+    {
+        LOG_ERROR("Lista de portas inválida: %s\n", serialPorts);
+        return -1;
+    }
+    LOG_INFO("Ligação agregada com %d portas.\n", nBondLinks);
+
+    if (llRole == LlTx)
+    {
+        bond.fd = open(filename, O_RDONLY);
+        if (bond.fd < 0)
+        {
+            perror("Não foi possível abrir ficheiro\n");
+            return -1;
+        }
+        struct stat st;
+        fstat(bond.fd, &st);
+        bond.fileSize = st.st_size;
+    }
+    else
+    {
+        bond.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (bond.fd < 0)
+        {
+            perror("Não foi possível abrir ficheiro\n");
+            return -1;
+        }
+    }
+
+    // Uma thread por ligação; cada uma tem o seu contexto de ligação
+    pthread_t threads[MAX_BOND_LINKS];
+    double start = now();
+    for (int i = 0; i < nBondLinks; i++)
+    {
+        pthread_create(&threads[i], NULL, llRole == LlTx ? transmitterLink : receiverLink, &links[i]);
+    }
+    for (int i = 0; i < nBondLinks; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    // O receptor escreve por posição; garante o tamanho final do ficheiro
+    if (llRole == LlRx && ftruncate(bond.fd, bond.fileSize) < 0)
+    {
+        perror("ftruncate");
+    }
+    close(bond.fd);
+    free(bond.received);
+
+    // Estatísticas por ligação e agregadas
+    logFlush();
+    unsigned total = 0;
+    for (int i = 0; i < nBondLinks; i++)
+    {
+        printf("  %s: %u blocos, %u bytes, %.0f bits/s\n", links[i].params.serialPort, links[i].chunks,
+               links[i].bytes, links[i].elapsed > 0 ? links[i].bytes * 8 / links[i].elapsed : 0.0);
+        total += links[i].bytes;
+    }
+    printf("Total: %u bytes em %.3f segundos (%.0f bits/s)\n", total, elapsed, elapsed > 0 ? total * 8 / elapsed : 0.0);
+
+    if ((llRole == LlTx && total != bond.fileSize) || (llRole == LlRx && !atomic_load(&bond.complete)))
+    {
+        LOG_ERROR("Transmissão falhou. \n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "dedup.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bits altos do gear hash que têm de ser zero num limite (média de 4 KiB)
+#define CUT_MASK 0xFFF0000000000000ULL
+
+// Ocupação máxima da tabela antes de duplicar (em percentagem)
+#define MAX_LOAD 70
+
+static uint64_t gear[256];
+static pthread_once_t gearOnce = PTHREAD_ONCE_INIT;
+
+// Tabela fixa de valores pseudo-aleatórios (splitmix64); tem de ser igual nos dois lados
+static void gearInit(void)
+{
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	for (int i = 0; i < 256; i++)
+	{
+		x += 0x9E3779B97F4A7C15ULL;
+		uint64_t z = x;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+int dedupCut(const unsigned char *data, int len)
+{
+	pthread_once(&gearOnce, gearInit);
+
+	if (len > DEDUP_CHUNK_MAX)
+	{
+		len = DEDUP_CHUNK_MAX;
+	}
+
+	// Cada byte sai do hash ao fim de 64 deslocamentos: o limite só depende da vizinhança
+	uint64_t h = 0;
+	for (int i = 0; i < len; i++)
+	{
+		h = (h << 1) + gear[data[i]];
+		if (i + 1 >= DEDUP_CHUNK_MIN && (h & CUT_MASK) == 0)
+		{
+			return i + 1;
+		}
+	}
+	return len;
+}
+
+typedef struct
+{
+	unsigned char hash[SHA256_SIZE];
+	off_t offset;
+	unsigned length;
+	int used;
+} Entry;
+
+struct ChunkIndex
+{
+	Entry *entries;
+	size_t capacity; // Potência de 2
+	size_t count;
+};
+
+// Posição inicial de um hash na tabela (o SHA-256 já é uniforme)
+static size_t slot(const unsigned char *hash, size_t capacity)
+{
+	uint64_t key;
+	memcpy(&key, hash, sizeof(key));
+	return key & (capacity - 1);
+}
+
+ChunkIndex *chunkIndexCreate(void)
+{
+	ChunkIndex *index = calloc(1, sizeof(ChunkIndex));
+	if (index == NULL)
+	{
+		return NULL;
+	}
+	index->capacity = 1024;
+	index->entries = calloc(index->capacity, sizeof(Entry));
+	if (index->entries == NULL)
+	{
+		free(index);
+		return NULL;
+	}
+	return index;
+}
+
+void chunkIndexDestroy(ChunkIndex *index)
+{
+	free(index->entries);
+	free(index);
+}
+
+// Insere sem verificar a ocupação
+static void insert(Entry *entries, size_t capacity, const Entry *e)
+{
+	size_t i = slot(e->hash, capacity);
+	while (entries[i].used)
+	{
+		i = (i + 1) & (capacity - 1);
+	}
+	entries[i] = *e;
+}
+
+int chunkIndexAdd(ChunkIndex *index, const unsigned char hash[SHA256_SIZE], off_t offset, unsigned length)
+{
+	off_t o;
+	unsigned l;
+	if (chunkIndexFind(index, hash, &o, &l))
+	{
+		return 0; // Fica a primeira ocorrência
+	}
+
+	if ((index->count + 1) * 100 > index->capacity * MAX_LOAD)
+	{
+		size_t capacity = index->capacity * 2;
+		Entry *entries = calloc(capacity, sizeof(Entry));
+		if (entries == NULL)
+		{
+			return -1;
+		}
+		for (size_t i = 0; i < index->capacity; i++)
+		{
+			if (index->entries[i].used)
+			{
+				insert(entries, capacity, &index->entries[i]);
+			}
+		}
+		free(index->entries);
+		index->entries = entries;
+		index->capacity = capacity;
+	}
+
+	Entry e = {.offset = offset, .length = length, .used = 1};
+	memcpy(e.hash, hash, SHA256_SIZE);
+	insert(index->entries, index->capacity, &e);
+	index->count++;
+	return 0;
+}
+
+int chunkIndexFind(const ChunkIndex *index, const unsigned char hash[SHA256_SIZE], off_t *offset, unsigned *length)
+{
+	size_t i = slot(hash, index->capacity);
+	while (index->entries[i].used)
+	{
+		if (memcmp(index->entries[i].hash, hash, SHA256_SIZE) == 0)
+		{
+			*offset = index->entries[i].offset;
+			*length = index->entries[i].length;
+			return 1;
+		}
+		i = (i + 1) & (index->capacity - 1);
+	}
+	return 0;
+}
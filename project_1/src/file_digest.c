@@ -0,0 +1,111 @@
+#include "file_digest.h"
+#include <pthread.h>
+#include <string.h>
+
+// SHA-256 de uma região inteira de zeros, calculado uma só vez
+static unsigned char zeroRegionHash[SHA256_SIZE];
+static pthread_once_t zeroRegionOnce = PTHREAD_ONCE_INIT;
+
+static void hashZeros(Sha256 *sha, unsigned len)
+{
+	static const unsigned char zeros[4096];
+	for (unsigned done = 0; done < len; done += sizeof(zeros))
+	{
+		sha256Update(sha, zeros, len - done < sizeof(zeros) ? len - done : sizeof(zeros));
+	}
+}
+
+static void zeroRegionInit(void)
+{
+	Sha256 sha;
+	sha256Init(&sha);
+	hashZeros(&sha, DIGEST_REGION_SIZE);
+	sha256Final(&sha, zeroRegionHash);
+}
+
+void digestInit(FileDigest *d, RegionCallback onRegion, void *user)
+{
+	pthread_once(&zeroRegionOnce, zeroRegionInit);
+	sha256Init(&d->file);
+	sha256Init(&d->region);
+	d->regionFill = 0;
+	d->regionIndex = 0;
+	d->regionHole = 1;
+	d->onRegion = onRegion;
+	d->user = user;
+}
+
+// Fecha a região atual e começa a seguinte
+static void closeRegion(FileDigest *d)
+{
+	unsigned char hash[SHA256_SIZE];
+	if (d->regionHole && d->regionFill == DIGEST_REGION_SIZE)
+	{
+		memcpy(hash, zeroRegionHash, SHA256_SIZE);
+	}
+	else
+	{
+		if (d->regionHole)
+		{
+			hashZeros(&d->region, d->regionFill); // Só o buraco no fim do ficheiro
+		}
+		sha256Final(&d->region, hash);
+	}
+	sha256Update(&d->file, hash, SHA256_SIZE);
+	if (d->onRegion != NULL && !d->regionHole)
+	{
+		d->onRegion(d->user, d->regionIndex, hash);
+	}
+	sha256Init(&d->region);
+	d->regionFill = 0;
+	d->regionIndex++;
+	d->regionHole = 1;
+}
+
+void digestUpdate(FileDigest *d, const unsigned char *data, off_t len)
+{
+	while (len > 0)
+	{
+		// Nunca passa do fim da região atual
+		unsigned n = DIGEST_REGION_SIZE - d->regionFill;
+		if ((off_t)n > len)
+		{
+			n = len;
+		}
+
+		// Numa região só com buracos os zeros ficam por hashear até chegarem dados
+		if (data == NULL)
+		{
+			if (!d->regionHole)
+			{
+				hashZeros(&d->region, n);
+			}
+		}
+		else
+		{
+			if (d->regionHole)
+			{
+				hashZeros(&d->region, d->regionFill);
+				d->regionHole = 0;
+			}
+			sha256Update(&d->region, data, n);
+			data += n;
+		}
+		d->regionFill += n;
+		len -= n;
+
+		if (d->regionFill == DIGEST_REGION_SIZE)
+		{
+			closeRegion(d);
+		}
+	}
+}
+
+void digestFinal(FileDigest *d, unsigned char out[SHA256_SIZE])
+{
+	if (d->regionFill > 0)
+	{
+		closeRegion(d);
+	}
+	sha256Final(&d->file, out);
+}
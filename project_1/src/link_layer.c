@@ -1,11 +1,15 @@
 #include "link_layer.h"
-#include "serial_port.h"
+#include "link_layer_ctx.h"
+#include "log.h"
+#include "realtime.h"
+#include "trace.h"
+#include "transport.h"
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <signal.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 
 // Define POSIX compliance para compatibilidade com sistemas POSIX
 #define _POSIX_SOURCE 1
@@ -18,6 +22,9 @@
 #define MAX_DATA_SIZE 1000
 #define CONTROL_FRAME_SIZE 5
 
+// Tamanho máximo de uma trama I na linha (depois do stuffing)
+#define MAX_FRAME_SIZE (2 * MAX_DATA_SIZE + 7)
+
 // Define valores de octetos usados no protocolo de enlace
 #define FLAG 0x7E
 #define A 0x03
@@ -25,29 +32,55 @@
 #define C_SET 0x03
 #define C_UA 0x07
 #define C_DISC 0x0B
+#define C_SET_COBS 0x43 // SET a pedir enquadramento COBS
+#define C_UA_COBS 0x47	// UA a aceitar enquadramento COBS
+#define C_PROBE 0x4F	// Trama de sonda: o receptor devolve-a tal como chegou
+#define C_PROBE_ECHO 0x53
 #define ESC 0x7D
 #define ESC_FLAG 0x5E
 #define ESC_ESC 0x5D
 #define BCC 0x5D
 
-// Variáveis globais de configuração de retransmissões e timeout
-int MAX_RETRIES;
-int TIMEOUT;
-
-// Flags de controle para o alarme
-int alarmEnabled = FALSE;
-int alarmCount = 0;
-
-extern int fd; // Descritor de arquivo da porta serial
-
 // Códigos de controle e resposta
-unsigned char C_I = 0x0;
-unsigned char C_II = 0x80;
-unsigned char RR = 0xAB;	   // 0xAA para 0, AB para 1
-unsigned char REJ = 0x54;	   // Código de rejeição de quadro
-unsigned char trans_frame = 0; // Número de sequência da trama
-
-LinkLayerRole role; // Define o papel da conexão (Transmissor ou Receptor)
+#define C_I 0x0
+#define C_II 0x80
+#define RR_0 0xAA // RR a pedir a trama 0
+#define RR_1 0xAB // RR a pedir a trama 1
+#define REJ 0x54  // Código de rejeição de quadro
+
+// Estado de uma ligação. Cada instância tem o seu canal, número de sequência,
+// temporizador e estatísticas, pelo que várias ligações podem correr em threads
+// diferentes do mesmo processo.
+struct ll_ctx
+{
+	Transport *transport;	   // Canal usado pela ligação (porta série, socket, FIFO, ...)
+	LinkLayerRole role;		   // Papel da conexão (Transmissor ou Receptor)
+	int maxRetries;			   // Número máximo de retransmissões
+	int timeoutMs;			   // Timeout em milissegundos
+	int frameSize;			   // Tamanho máximo de uma trama I na linha
+	LlFraming framing;		   // Enquadramento das tramas I negociado no llopen
+	unsigned char trans_frame; // Número de sequência da trama
+
+	// Temporizador da instância (substitui o alarme/SIGALRM do processo)
+	int alarmEnabled;
+	int alarmCount;
+	struct timespec deadline;
+
+	// Estatísticas
+	int framesSent;
+	int retransmissions;
+	int timeouts;
+	int rejReceived;
+	int framesReceived;
+	int rejSent;
+	LatencyHist turnaround; // Do fim de uma trama I até ao envio do RR/REJ
+
+	int broken; // O canal falhou ou foi fechado pelo outro lado
+	const atomic_int *cancel; // Pedido para desistir de esperar (LlOptions.cancel)
+};
+
+// Contexto usado pelas funções llopen/llwrite/llread/llclose
+static ll_ctx *defaultCtx = NULL;
 
 // Enum para estados da leitura de bytes da trama de controle
 typedef enum
@@ -57,224 +90,291 @@ typedef enum
 	COMPLETE		  // Trama recebida completamente
 } State;
 
-// Definição do enum para os estados da máquina de estados
-typedef enum
+// Arma o temporizador da instância com o timeout configurado, no relógio do
+// transporte (o tempo virtual numa ligação simulada)
+static void alarmStart(ll_ctx *ctx)
 {
-	START,
-	FLAG_RCV, // FLAG recebida
-	A_RCV,	  // Campo de endereço recebido
-	C_RCV,	  // Campo de controle recebido
-	BCC_OK,	  // BCC verificado
-	END		  // Fim da leitura da trama
-} message_state;
-
-// Handler do alarme, incrementa a contagem e exibe o número de tentativas
-void alarmHandler(int signal)
-{
-	alarmEnabled = FALSE; // Desativa alarme após sinal
-	alarmCount++;		  // Incrementa contagem do alarme
-	printf("Alarme #%d\n", alarmCount);
-
-	if (alarmCount == MAX_RETRIES)
+	transportNow(ctx->transport, &ctx->deadline);
+	ctx->deadline.tv_sec += ctx->timeoutMs / 1000;
+	ctx->deadline.tv_nsec += (ctx->timeoutMs % 1000) * 1000000L;
+	if (ctx->deadline.tv_nsec >= 1000000000L)
 	{
-		printf("Número de tentativas excedido\n");
+		ctx->deadline.tv_sec++;
+		ctx->deadline.tv_nsec -= 1000000000L;
 	}
+	ctx->alarmEnabled = TRUE;
 }
 
-////////////////////////////////////////////////
-// LLOPEN
-////////////////////////////////////////////////
-int llopen(LinkLayer connectionParameters)
+// Cancela o temporizador da instância
+static void alarmStop(ll_ctx *ctx)
 {
-	// Configuração dos parâmetros de retransmissão e timeout
-	MAX_RETRIES = connectionParameters.nRetransmissions;
-	TIMEOUT = connectionParameters.timeout;
+	ctx->alarmEnabled = FALSE;
+}
 
-	// Inicializa a porta serial com as configurações fornecidas
-	fd = openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate);
-	if (fd < 0)
+// Chamado quando o temporizador expira, incrementa a contagem e exibe o número de tentativas
+static void alarmHandler(ll_ctx *ctx)
+{
+	ctx->alarmEnabled = FALSE; // Desativa alarme após expirar
+	ctx->alarmCount++;		   // Incrementa contagem do alarme
+	ctx->timeouts++;
+	TRACE_INSTANT("timer fired", ctx->alarmCount);
+	LOG_DEBUG("Alarme #%d\n", ctx->alarmCount);
+
+	if (ctx->alarmCount == ctx->maxRetries)
 	{
-		return -1; // Retorna erro se a abertura falhar
+		LOG_WARN("Número de tentativas excedido\n");
 	}
+}
 
-	role = connectionParameters.role; // Define o papel da conexão
+// Milissegundos até ao fim do prazo do temporizador (negativo se já passou)
+static int alarmRemainingMs(const ll_ctx *ctx)
+{
+	struct timespec now;
+	transportNow(ctx->transport, &now);
+	return (ctx->deadline.tv_sec - now.tv_sec) * 1000 + (ctx->deadline.tv_nsec - now.tv_nsec) / 1000000;
+}
 
-	// Lógica do Transmissor (tx)
-	if (role == 0)
+// Lê um byte do canal sem ultrapassar o temporizador (se estiver armado).
+// Sem temporizador, desiste (como se o canal falhasse) quando já havia pedido
+// de cancelamento no início de uma espera de um timeout inteiro sem bytes.
+// Retorna -1 em erro, 0 se o temporizador expirou, 1 se um byte foi lido.
+static int readByte(ll_ctx *ctx, unsigned char *byte)
+{
+	while (TRUE)
 	{
-		// Inicializa trama SET e UA esperada
-		unsigned char SET[CONTROL_FRAME_SIZE] = {FLAG, A, C_SET, A ^ C_SET, FLAG};
-		unsigned char UA_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_UA, A ^ C_UA, FLAG};
-
-		unsigned char response[CONTROL_FRAME_SIZE] = {0}; // Armazena resposta do receptor
-
-		State state = WAITING_FOR_FLAG; // Estado inicial da máquina de estados
+		int timeoutMs = -1;
+		int cancelled = FALSE;
+		if (!ctx->alarmEnabled && ctx->cancel != NULL)
+		{
+			cancelled = atomic_load(ctx->cancel);
+			timeoutMs = ctx->timeoutMs;
+		}
+		if (ctx->alarmEnabled)
+		{
+			timeoutMs = alarmRemainingMs(ctx);
+			if (timeoutMs <= 0)
+			{
+				alarmHandler(ctx);
+				return 0;
+			}
+		}
 
-		int index = 0;
-		int done = 0;
-		int retries = 0;
+		int bytesRead = transportReadByteTimeout(ctx->transport, byte, timeoutMs);
+		if (bytesRead < 0 || (bytesRead == 0 && cancelled))
+		{
+			ctx->broken = TRUE;
+			return -1;
+		}
+		if (bytesRead == 0 && !ctx->alarmEnabled && ctx->cancel != NULL)
+		{
+			continue; // Ainda sem cancelamento: continua à espera
+		}
+		if (bytesRead != 0 || !ctx->alarmEnabled)
+		{
+			return bytesRead;
+		}
+	}
+}
 
-		// Configura o handler do alarme
-		struct sigaction act = {0};
-		act.sa_handler = &alarmHandler;
-		// sigemptyset(&act.sa_mask);
-		// act.sa_flags = 0;
+// Lê uma trama de controlo (FLAG A C BCC1 FLAG) para response.
+// Retorna -1 em erro, 0 se o temporizador expirou, 1 se uma trama foi recebida.
+static int readControlFrame(ll_ctx *ctx, unsigned char *response)
+{
+	State state = WAITING_FOR_FLAG; // Estado inicial da máquina de estados
+	int index = 0;
 
-		if (sigaction(SIGALRM, &act, NULL) == -1)
+	while (state != COMPLETE)
+	{
+		unsigned char byte;
+		int bytesRead = readByte(ctx, &byte);
+		if (bytesRead <= 0)
 		{
-			perror("sigaction");
-			exit(EXIT_FAILURE);
+			return bytesRead;
 		}
-		//(void)signal(SIGALRM, alarmHandler);
 
-		// Loop de envio até confirmação ou limite de tentativas
-		while (!done && retries < MAX_RETRIES)
+		// Processa o byte de acordo com o estado da leitura
+		switch (state)
 		{
-			if (!alarmEnabled)
+		case WAITING_FOR_FLAG:
+			if (byte == FLAG)
 			{
-				printf("Transmissor: Enviar SET. \n");
-				writeBytesSerialPort(SET, sizeof(SET)); // Enviar trama SET
-				alarm(TIMEOUT);							// Ativa alarme com timeout
-				alarmEnabled = TRUE;
-				retries++;
-				state = WAITING_FOR_FLAG;
-				index = 0;
+				TRACE_INSTANT("first control byte", 0);
+				response[0] = byte;
+				index = 1;
+				state = READING;
 			}
-
-			unsigned char byte;
-			int bytesRead = readByteSerialPort(&byte);
-
-			// Verifica timeout ou erro de leitura
-			if (bytesRead <= 0)
+			break;
+		case READING:
+			if (byte == FLAG && index < CONTROL_FRAME_SIZE - 1)
 			{
-				if (errno == EINTR)
-				{
-					printf("Timeout. Reenviar SET\n");
-					continue;
-				}
-				else
-				{
-					return -1; // Erro de leitura
-				}
+				index = 1; // FLAG fora de sítio: recomeça a trama a partir dela
+				break;
 			}
-
-			// Máquina de estados para processar a resposta UA
-			if (bytesRead > 0)
+			response[index++] = byte;
+			if (index == CONTROL_FRAME_SIZE)
 			{
-				switch (state)
-				{
-				case WAITING_FOR_FLAG:
-					if (byte == FLAG)
-					{
-						response[index++] = byte;
-						state = READING;
-					}
-					break;
-				case READING:
-					response[index++] = byte;
-					if (index == CONTROL_FRAME_SIZE && byte == FLAG)
-					{
-						// Confirma recebimento de UA
-						if (memcmp(response, UA_EXPECTED, CONTROL_FRAME_SIZE) == 0)
-						{
-							printf("Transmissor: Recebido UA\n");
-							done = 1; // Conexão estabelecida
-							retries = 0;
-							alarm(0); // Cancela alarme
-						}
-						index = 0;
-						state = WAITING_FOR_FLAG;
-					}
-					break;
-				default:
-					break;
-				}
+				state = (byte == FLAG) ? COMPLETE : WAITING_FOR_FLAG;
 			}
+			break;
+		default:
+			break;
 		}
+	}
+	return 1;
+}
 
-		if (!done)
+// Lê uma trama completa (de FLAG a FLAG, ainda com stuffing) para frame,
+// com MAX_FRAME_SIZE bytes. Respeita o temporizador se estiver armado.
+// Retorna o tamanho da trama, 0 se o temporizador expirou ou -1 em erro.
+static int readRawFrame(ll_ctx *ctx, unsigned char *frame)
+{
+	unsigned char byte;	// Byte individual para leitura da trama
+	int frame_pos = 0;	// Posição no buffer da trama
+
+	// Loop para ler a trama byte a byte e armazenar no buffer
+	while (TRUE)
+	{
+		// Lê um byte de cada vez
+		int ret = readByte(ctx, &byte);
+		if (ret <= 0)
 		{
-			return -1; // Se falha em receber UA
+			return ret;
 		}
 
-		alarm(0); // Desativa alarme
-		return fd;
+		// Ignora bytes até ao início de uma trama
+		if (frame_pos == 0 && byte != FLAG)
+		{
+			continue;
+		}
+
+		// Trama demasiado longa: descarta e espera pela próxima FLAG
+		if (frame_pos == MAX_FRAME_SIZE)
+		{
+			frame_pos = 0;
+			continue;
+		}
+
+		frame[frame_pos++] = byte; // Armazena o byte lido na posição corrente
+
+		// Se FLAG é encontrada (indica o fim da trama)
+		if (byte == FLAG && frame_pos > 1)
+		{
+			return frame_pos;
+		}
 	}
-	// Lógica do Receptor (rx)
-	else if (role == 1)
+}
+
+// Escreve byte em dest aplicando stuffing se for FLAG ou ESC.
+// Retorna o número de bytes escritos (1 ou 2).
+static int stuffByte(unsigned char *dest, unsigned char byte)
+{
+	if (byte == FLAG || byte == ESC)
 	{
-		// Inicializa trama UA e a SET esperada
-		unsigned char SET_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_SET, A ^ C_SET, FLAG};
-		unsigned char UA[CONTROL_FRAME_SIZE] = {FLAG, A, C_UA, A ^ C_UA, FLAG};
+		dest[0] = ESC;
+		dest[1] = byte ^ 0x20; // Realiza XOR com 0x20
+		return 2;
+	}
+	dest[0] = byte; // Insere o dado normalmente
+	return 1;
+}
 
-		unsigned char response[CONTROL_FRAME_SIZE] = {0}; // Armazena resposta do transmissor
+// Codifica src com COBS (Consistent Overhead Byte Stuffing) para dest.
+// O COBS elimina os bytes 0x00 com no máximo 1 byte extra por cada 254; o
+// resultado é depois XOR 0x7E, pelo que nenhum byte codificado vale FLAG.
+// Retorna o número de bytes escritos (no máximo n + n / 254 + 1).
+static int cobsEncode(const unsigned char *src, int n, unsigned char *dest)
+{
+	int codePos = 0; // Posição do byte de código do bloco atual
+	int out = 1;
+	unsigned char code = 1; // Distância até ao próximo zero
 
-		State state = WAITING_FOR_FLAG; // Estado inicial da máquina de estados
+	for (int i = 0; i < n; i++)
+	{
+		if (src[i] != 0)
+		{
+			dest[out++] = src[i] ^ FLAG;
+			code++;
+		}
+		if (src[i] == 0 || code == 0xFF)
+		{
+			dest[codePos] = code ^ FLAG;
+			codePos = out++;
+			code = 1;
+		}
+	}
+	dest[codePos] = code ^ FLAG;
+	return out;
+}
 
-		int index = 0;
-		int done = 0;
+// Descodifica n bytes COBS de src para dest (com no máximo max bytes).
+// Retorna o número de bytes descodificados ou -1 se a codificação for inválida.
+static int cobsDecode(const unsigned char *src, int n, unsigned char *dest, int max)
+{
+	int in = 0;
+	int out = 0;
 
-		// Loop de recepção até confirmação do SET ou erro
-		while (!done)
+	while (in < n)
+	{
+		unsigned char code = src[in++] ^ FLAG;
+		if (code == 0)
+		{
+			return -1;
+		}
+		for (int i = 1; i < code; i++)
 		{
-			unsigned char byte;
-			if (readByteSerialPort(&byte) <= 0)
+			if (in == n || out == max)
 			{
-				continue; // Continua tentando até receber um byte
+				return -1;
 			}
-
-			// Processa o byte de acordo com o estado da leitura
-			switch (state)
+			dest[out++] = src[in++] ^ FLAG;
+		}
+		// Um bloco mais curto do que o máximo termina num zero (exceto o último)
+		if (code < 0xFF && in < n)
+		{
+			if (out == max)
 			{
-			case WAITING_FOR_FLAG:
-				if (byte == FLAG)
-				{
-					response[index++] = byte;
-					state = READING;
-				}
-				break;
-			case READING:
-				response[index++] = byte;
-				if (index == CONTROL_FRAME_SIZE && byte == FLAG)
-				{
-					// Confirma recebimento de SET
-					if (memcmp(response, SET_EXPECTED, CONTROL_FRAME_SIZE) == 0)
-					{
-						printf("Receptor: Recebido SET, enviar UA.\n");
-						writeBytesSerialPort(UA, sizeof(UA)); // Enviar trama UA
-						done = 1;							  // Conexão estabelecida
-					}
-					else
-					{
-						index = 0; // Reinicia se o pacote estiver incorreto
-					}
-					state = WAITING_FOR_FLAG;
-				}
-				break;
-			default:
-				break;
+				return -1;
 			}
+			dest[out++] = 0;
 		}
-		return fd;
 	}
-	return -1; // Retorna erro se papel desconhecido
+	return out;
 }
 
-////////////////////////////////////////////////
-// LLWRITE
-////////////////////////////////////////////////
-int llwrite(const unsigned char *buf, int bufSize)
+// Desfaz o stuffing de n bytes de src para dest (com no máximo max bytes).
+// Retorna o número de bytes obtidos ou -1 se não couberem.
+static int destuff(const unsigned char *src, int n, unsigned char *dest, int max)
 {
+	int out = 0;
+	for (int i = 0; i < n; i++)
+	{
+		unsigned char value = src[i];
 
-	unsigned char frame[MAX_DATA_SIZE + 6]; // Define o tamanho da trama (cabeçalho + BCC + dados)
-	int packetSize = 0;						// Tamanho do pacote de dados
+		// Detecção de escape: FLAG e ESC são enviados como ESC seguido de valor ^ 0x20
+		if (value == ESC && i + 1 < n)
+		{
+			i++; // Avança para o byte escapado
+			value = src[i] ^ 0x20;
+		}
+		if (out == max)
+		{
+			return -1;
+		}
+		dest[out++] = value;
+	}
+	return out;
+}
 
-	frame[0] = FLAG; // Início da trama
-	frame[1] = A;	 // Endereço
+// Constrói em frame a trama com controlo C e os dados buf (com stuffing ou
+// COBS, consoante o enquadramento negociado). Retorna o tamanho total.
+static int buildFrame(const ll_ctx *ctx, unsigned char C, const unsigned char *buf, int bufSize, unsigned char *frame)
+{
+	int packetSize = 0; // Tamanho do pacote de dados
 
-	// Define o campo de controle (C_I) e alterna entre os frames 0 e 1
-	frame[2] = (C_I | (trans_frame == 0 ? 0x00 : 0x80)); // Frame 0 para C_I = 0x00, frame 1 para C_I = 0x80
-	frame[3] = frame[1] ^ frame[2];						 // Calcula BCC1 como XOR entre A e C_I
+	frame[0] = FLAG;				// Início da trama
+	frame[1] = A;					// Endereço
+	frame[2] = C;					// Campo de controlo
+	frame[3] = frame[1] ^ frame[2]; // Calcula BCC1 como XOR entre A e C
 
 	// Calcula o BCC2 a partir dos dados
 	unsigned char bcc2 = 0;
@@ -283,429 +383,780 @@ int llwrite(const unsigned char *buf, int bufSize)
 		bcc2 ^= buf[i];
 	}
 
-	// Preenche a trama com os dados e aplica stuffing
-	for (int i = 0; i < bufSize; i++)
+	if (ctx->framing == LlFramingCobs)
 	{
-		// Aplica stuffing se encontrar FLAG ou ESC
-		if (buf[i] == FLAG || buf[i] == ESC)
+		// COBS: dados e BCC2 codificados de uma vez, sem nenhum byte igual a FLAG
+		unsigned char body[MAX_DATA_SIZE + 1];
+		memcpy(body, buf, bufSize);
+		body[bufSize] = bcc2;
+		packetSize = cobsEncode(body, bufSize + 1, frame + 4);
+	}
+	else
+	{
+		// Preenche a trama com os dados e aplica stuffing
+		for (int i = 0; i < bufSize; i++)
 		{
-			frame[4 + packetSize] = ESC;
-			frame[4 + packetSize + 1] = buf[i] ^ 0x20; // Realiza XOR com 0x20
-			packetSize += 2;
+			packetSize += stuffByte(frame + 4 + packetSize, buf[i]);
 		}
-		else
+
+		// Adiciona BCC2 ao final dos dados (também sujeito a stuffing, pode valer FLAG)
+		packetSize += stuffByte(frame + 4 + packetSize, bcc2);
+	}
+	frame[4 + packetSize] = FLAG; // Adiciona FLAG de fechamento
+
+	return 4 + packetSize + 1; // Cabeçalho + dados e BCC2 com stuffing + FLAG final
+}
+
+////////////////////////////////////////////////
+// LLOPEN
+////////////////////////////////////////////////
+// Tamanhos (de dados) das tramas de sonda e repetições de cada um
+static const int probeSizes[] = {32, 256, 900};
+#define PROBE_REPEATS 2
+
+// Menor tamanho de trama considerado na escolha
+#define PROBE_MIN_FRAME 32
+
+// Eficiência prevista do stop-and-wait com tramas de frameSize bytes na linha:
+// fração da capacidade usada por dados, contando o RR, o atraso fixo e as
+// retransmissões (cada perda custa a trama mais o RTO)
+static double predictEfficiency(int frameSize, double rate, double delay, double byteError, double rto)
+{
+	double pOk = 1.0;
+	for (int i = 0; i < frameSize + CONTROL_FRAME_SIZE; i++)
+	{
+		pOk *= 1.0 - byteError;
+	}
+	double frameTime = frameSize / rate;
+	double cycle = frameTime + CONTROL_FRAME_SIZE / rate + delay;
+	double expected = cycle + (1.0 - pOk) / pOk * (frameTime + rto);
+	return (frameSize - 6) / rate / expected;
+}
+
+// Envia tramas de sonda de vários tamanhos, que o receptor devolve, e ajusta
+// o modelo rtt = atraso + 2 * tamanho / débito. Escolhe o tamanho de trama e o
+// RTO que maximizam a eficiência prevista. O protocolo é stop-and-wait, pelo
+// que a janela é sempre 1.
+static void probeLink(ll_ctx *ctx)
+{
+	unsigned char data[MAX_DATA_SIZE];
+	unsigned char frame[MAX_FRAME_SIZE];
+	unsigned char echo[MAX_FRAME_SIZE];
+	double sx = 0, sy = 0, sxx = 0, sxy = 0; // Somas para a regressão linear
+	int samples = 0, failures = 0;
+	double bytesSent = 0;
+
+	// Dados que não precisam de stuffing, para o tamanho na linha ser o previsto
+	for (int i = 0; i < MAX_DATA_SIZE; i++)
+	{
+		data[i] = 'A' + i % 26;
+	}
+
+	for (int s = 0; s < (int)(sizeof(probeSizes) / sizeof(probeSizes[0])); s++)
+	{
+		for (int r = 0; r < PROBE_REPEATS; r++)
 		{
-			frame[4 + packetSize] = buf[i]; // Insere o dado normalmente
-			packetSize++;
+			int size = buildFrame(ctx, C_PROBE, data, probeSizes[s], frame);
+			struct timespec t0, t1;
+			transportNow(ctx->transport, &t0);
+			transportWriteBytes(ctx->transport, frame, size);
+			bytesSent += 2.0 * size;
+			alarmStart(ctx);
+
+			// Espera pela sonda devolvida (as outras tramas são ignoradas)
+			int len;
+			while ((len = readRawFrame(ctx, echo)) > 0 && !(len >= CONTROL_FRAME_SIZE && echo[2] == C_PROBE_ECHO))
+			{
+			}
+			alarmStop(ctx);
+			ctx->alarmCount = 0;
+			if (len < 0)
+			{
+				return;
+			}
+			if (len == 0 && samples == 0 && failures == 0)
+			{
+				LOG_WARN("Sonda sem resposta: receptor sem suporte, parâmetros mantidos.\n");
+				ctx->timeouts = 0;
+				return;
+			}
+			transportNow(ctx->transport, &t1);
+
+			// Só conta se voltou exatamente o que foi enviado
+			if (len != size || memcmp(echo + 4, frame + 4, size - 4) != 0)
+			{
+				failures++;
+				continue;
+			}
+			double rtt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+			sx += size;
+			sy += rtt;
+			sxx += (double)size * size;
+			sxy += size * rtt;
+			samples++;
 		}
 	}
+	ctx->timeouts = 0;
 
-	frame[4 + packetSize] = bcc2;	  // Adiciona BCC2 ao final dos dados
-	frame[4 + packetSize + 1] = FLAG; // Adiciona FLAG de fechamento
+	if (samples < 2 || samples * sxx - sx * sx <= 0)
+	{
+		LOG_WARN("Sonda: amostras insuficientes, parâmetros mantidos.\n");
+		return;
+	}
 
-	int totalSize = 4 + packetSize + 2; // Define o tamanho total da trama (Cabeçalho + dados com stuffing + BCC2 + FLAG final)
-	int bytes_written = 0;
+	// rtt = delay + slope * tamanho, com slope = 2 / débito (a sonda vai e volta)
+	double slope = (samples * sxy - sx * sy) / (samples * sxx - sx * sx);
+	double delay = (sy - slope * sx) / samples;
+	double rate = (slope > 1e-9) ? 2.0 / slope : 1e9;
+	if (delay < 0)
+	{
+		delay = 0;
+	}
+	double byteError = failures / bytesSent;
 
-	// Configura o handler para o alarme
-	struct sigaction act = {0};
-	act.sa_handler = &alarmHandler;
-	// sigemptyset(&act.sa_mask);
-	// act.sa_flags = 0;
+	// Escolhe o tamanho de trama com maior eficiência prevista
+	int maxFrame = MAX_DATA_SIZE + 6;
+	int best = ctx->frameSize;
+	double bestS = -1, bestRto = 0;
+	for (int f = PROBE_MIN_FRAME; f <= maxFrame; f += 16)
+	{
+		int size = (f + 16 > maxFrame) ? maxFrame : f;
+		double rto = 2.0 * (delay + (size + CONTROL_FRAME_SIZE) / rate) + 0.010;
+		double S = predictEfficiency(size, rate, delay, byteError, rto);
+		if (S > bestS)
+		{
+			bestS = S;
+			best = size;
+			bestRto = rto;
+		}
+	}
 
-	if (sigaction(SIGALRM, &act, NULL) == -1)
+	// O RTO nunca passa do timeout configurado
+	int rtoMs = (int)(bestRto * 1000) + 1;
+	if (rtoMs < ctx->timeoutMs)
 	{
-		perror("sigaction");
-		exit(EXIT_FAILURE);
+		ctx->timeoutMs = rtoMs;
 	}
-	//(void)signal(SIGALRM, alarmHandler);
+	ctx->frameSize = best;
 
-	int retryCount = 0;	  // Contador de tentativas de reenvio
-	int REJ_received = 0; // Flag para rejeição de trama
-	alarmCount = 0;
+	LOG_INFO("Sonda: atraso %.2f ms, débito %.0f bytes/s, erro por byte %.2e (%d/%d sondas falharam)\n",
+		   delay * 1000, rate, byteError, failures, samples + failures);
+	LOG_INFO("Sonda: janela 1 (stop-and-wait), trama %d bytes, RTO %d ms, eficiência prevista %.3f\n",
+		   ctx->frameSize, ctx->timeoutMs, bestS);
+}
 
-	// Configura resposta esperada: RR para ACK e REJ para NACK
-	RR = (trans_frame == 0) ? 0xAB : 0xAA;
-	unsigned char response[5];
-	unsigned char S_POS[5] = {FLAG, A, RR, A ^ RR, FLAG};	// Resposta RR (ACK)
-	unsigned char S_NEG[5] = {FLAG, A, REJ, A ^ REJ, FLAG}; // Resposta REJ (NACK)
 
-	// Loop de tentativas de envio com timeout e retransmissão
-	while (retryCount < MAX_RETRIES && alarmCount < 3)
+void lldefaultoptions(LlOptions *options)
+{
+	memset(options, 0, sizeof(LlOptions));
+	options->framing = LlFramingHdlc;
+
+	const char *framing = getenv("LL_FRAMING");
+	if (framing != NULL && strcmp(framing, "cobs") == 0)
 	{
-		bytes_written = writeBytesSerialPort(frame, totalSize); // Envia a trama
-		alarm(TIMEOUT);											// Define timeout para aguardar resposta
-		alarmEnabled = TRUE;
-		REJ_received = 0;
+		options->framing = LlFramingCobs;
+	}
 
-		// Loop para aguardar RR/REJ
-		while (alarmEnabled)
+	const char *probe = getenv("LL_PROBE");
+	options->probe = (probe != NULL && strcmp(probe, "0") != 0);
+}
+
+ll_ctx *llopen_ctx(LinkLayer connectionParameters)
+{
+	return llopen_ctx_opts(connectionParameters, NULL);
+}
+
+ll_ctx *llopen_ctx_opts(LinkLayer connectionParameters, const LlOptions *options)
+{
+	LlOptions defaults;
+	if (options == NULL)
+	{
+		lldefaultoptions(&defaults);
+		options = &defaults;
+	}
+
+	ll_ctx *ctx = calloc(1, sizeof(ll_ctx));
+	if (ctx == NULL)
+	{
+		return NULL;
+	}
+
+	// Configuração dos parâmetros de retransmissão e timeout
+	ctx->maxRetries = connectionParameters.nRetransmissions;
+	ctx->timeoutMs = connectionParameters.timeout * 1000;
+	ctx->frameSize = LL_DEFAULT_FRAME_SIZE;
+	ctx->role = connectionParameters.role; // Define o papel da conexão
+	ctx->cancel = options->cancel;
+
+	// Inicializa o transporte (porta série por omissão) com as configurações fornecidas
+	ctx->transport = transportOpen(connectionParameters.serialPort, connectionParameters.baudRate, connectionParameters.role);
+	if (ctx->transport == NULL)
+	{
+		free(ctx);
+		return NULL; // Retorna erro se a abertura falhar
+	}
+
+	unsigned char response[CONTROL_FRAME_SIZE] = {0}; // Armazena a trama recebida
+	int done = 0;
+
+	// Lógica do Transmissor (tx)
+	if (ctx->role == LlTx)
+	{
+		// Inicializa trama SET (a pedir COBS se for o caso) e as UA esperadas
+		unsigned char C = (options->framing == LlFramingCobs) ? C_SET_COBS : C_SET;
+		unsigned char SET[CONTROL_FRAME_SIZE] = {FLAG, A, C, A ^ C, FLAG};
+		unsigned char UA_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_UA, A ^ C_UA, FLAG};
+		unsigned char UA_COBS_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_UA_COBS, A ^ C_UA_COBS, FLAG};
+
+		int retries = 0;
+
+		// Loop de envio até confirmação ou limite de tentativas
+		while (!done && retries < ctx->maxRetries)
 		{
-			int index = 0;
+			if (!ctx->alarmEnabled)
+			{
+				LOG_INFO("Transmissor: Enviar SET. \n");
+				transportWriteBytes(ctx->transport, SET, sizeof(SET)); // Enviar trama SET
+				alarmStart(ctx);									   // Ativa alarme com timeout
+				retries++;
+			}
+
+			int ret = readControlFrame(ctx, response);
 
-			// Lê bytes da resposta
-			while (index < sizeof(response))
+			// Verifica timeout ou erro de leitura
+			if (ret < 0)
 			{
-				if (readByteSerialPort(&response[index]) > 0)
-				{
-					index++;
-				}
-				// Verifica timeout
-				else if (!alarmEnabled)
-				{
-					break;
-				}
+				break; // Erro de leitura
+			}
+			if (ret == 0)
+			{
+				LOG_WARN("Timeout. Reenviar SET\n");
+				continue;
 			}
 
-			// Verifica se recebeu resposta completa
-			if (index == sizeof(response))
+			// Confirma recebimento de UA; o tipo de UA indica o enquadramento aceite
+			if (memcmp(response, UA_EXPECTED, CONTROL_FRAME_SIZE) == 0 ||
+				memcmp(response, UA_COBS_EXPECTED, CONTROL_FRAME_SIZE) == 0)
 			{
-				if (memcmp(response, S_POS, sizeof(S_POS)) == 0) // RR recebido
-				{
-					printf("Recebido RR\n");
-					trans_frame = (trans_frame == 0) ? 1 : 0; // Alterna frame
-					alarm(0);								  // Cancela o alarme
-					alarmEnabled = FALSE;
-					alarmCount = 0;
-					printf("Enviados %d bytes.\n", bytes_written);
-					return bufSize; // Retorna sucesso
-				}
-				else if (memcmp(response, S_NEG, sizeof(S_NEG)) == 0) // REJ recebido
-				{
-					alarm(0); // Cancela o alarme
-					alarmEnabled = FALSE;
-					REJ_received = 1;
-					break; // Encerra loop para retransmitir
-				}
+				ctx->framing = (response[2] == C_UA_COBS) ? LlFramingCobs : LlFramingHdlc;
+				LOG_INFO("Transmissor: Recebido UA (%s)\n", ctx->framing == LlFramingCobs ? "COBS" : "HDLC");
+				done = 1;		// Conexão estabelecida
+				alarmStop(ctx); // Cancela alarme
 			}
 		}
+	}
+	// Lógica do Receptor (rx)
+	else if (ctx->role == LlRx)
+	{
+		// Inicializa as SET esperadas
+		unsigned char SET_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_SET, A ^ C_SET, FLAG};
+		unsigned char SET_COBS_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_SET_COBS, A ^ C_SET_COBS, FLAG};
 
-		// Lógica de retransmissão com base em timeout e REJ
-		if (!alarmEnabled)
+		// Loop de recepção até confirmação do SET ou erro
+		while (!done && readControlFrame(ctx, response) > 0)
 		{
-			if (REJ_received == 1)
-			{
-				retryCount++;
-				printf("REJ recebido. Retransmitir trama. Tentativa %d/%d\n", retryCount, MAX_RETRIES);
-			}
-			else if (alarmCount < MAX_RETRIES)
+			// Confirma recebimento de SET; o receptor aceita sempre o enquadramento pedido
+			if (memcmp(response, SET_EXPECTED, CONTROL_FRAME_SIZE) == 0 ||
+				memcmp(response, SET_COBS_EXPECTED, CONTROL_FRAME_SIZE) == 0)
 			{
-				printf("Timeout. Retransmitir trama.\n");
+				ctx->framing = (response[2] == C_SET_COBS) ? LlFramingCobs : LlFramingHdlc;
+				unsigned char C = (ctx->framing == LlFramingCobs) ? C_UA_COBS : C_UA;
+				unsigned char UA[CONTROL_FRAME_SIZE] = {FLAG, A, C, A ^ C, FLAG};
+				LOG_INFO("Receptor: Recebido SET (%s), enviar UA.\n", ctx->framing == LlFramingCobs ? "COBS" : "HDLC");
+				transportWriteBytes(ctx->transport, UA, sizeof(UA)); // Enviar trama UA
+				done = 1;											  // Conexão estabelecida
 			}
 		}
 	}
 
-	printf("Máximo de tentativas excedido.\n");
-	return -1; // Falha após o máximo de tentativas
+	// Sonda opcional para ajustar o tamanho das tramas e o timeout à ligação
+	if (done && ctx->role == LlTx && options->probe)
+	{
+		probeLink(ctx);
+	}
+
+	if (!done)
+	{
+		// Falha em estabelecer a ligação ou papel desconhecido
+		transportClose(ctx->transport);
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
 }
 
-////////////////////////////////////////////////
-// LLREAD
-////////////////////////////////////////////////
-int llread(unsigned char *packet)
+int llopen(LinkLayer connectionParameters)
 {
-	unsigned char frame[512] = {0};		   // Buffer para armazenar a trama recebida
-	unsigned char byte;					   // Byte individual para leitura da trama
-	int frame_pos = 0;					   // Posição no buffer da trama
-	int buf_pos = 0;					   // Posição no buffer do pacote de dados
-	unsigned char calculated_BCC2 = 0;	   // Valor de BCC2 calculado
-	unsigned char received_BCC2;		   // Valor de BCC2 recebido
-	int done = 0;						   // Flag para indicar o fim da leitura
-	RR = (trans_frame == 0) ? 0xAB : 0xAA; // Define o valor esperado de RR
+	defaultCtx = llopen_ctx(connectionParameters);
+	if (defaultCtx == NULL)
+	{
+		return -1;
+	}
+	// Transportes sem descritor (backends registados) devolvem na mesma um valor não negativo
+	int fd = llfd_ctx(defaultCtx);
+	return fd >= 0 ? fd : 1;
+}
 
-	// Loop para ler a trama byte a byte e armazenar no buffer
-	while (!done)
+int llfd_ctx(const ll_ctx *ctx)
+{
+	return transportFd(ctx->transport);
+}
+
+int llbroken_ctx(const ll_ctx *ctx)
+{
+	return ctx->broken;
+}
+
+int llframesize_ctx(const ll_ctx *ctx)
+{
+	return ctx->frameSize;
+}
+
+// Número de bytes que byte ocupa na linha depois do stuffing
+static int stuffedSize(unsigned char byte)
+{
+	return (byte == FLAG || byte == ESC) ? 2 : 1;
+}
+
+int llfit_ctx(const ll_ctx *ctx, const unsigned char *header, int headerLen, const unsigned char *data, int dataLen)
+{
+	// Espaço para o cabeçalho e dados com stuffing, sem FLAG A C BCC1, BCC2 e FLAG final
+	int budget = ctx->frameSize - 5;
+
+	// COBS: o custo não depende do conteúdo, no máximo 1 byte por cada 254 mais 1
+	if (ctx->framing == LlFramingCobs)
 	{
-		// Lê um byte de cada vez
-		if (readByteSerialPort(&byte) <= 0)
+		int fit = -1;
+		for (int n = budget - headerLen; n >= 0; n--)
+		{
+			int len = headerLen + n + 1;
+			if (len + len / 254 + 1 <= budget)
+			{
+				fit = n;
+				break;
+			}
+		}
+		if (fit > dataLen)
 		{
-			printf("Erro ao ler da serial port\n");
-			return -1; // Retorna erro se não consegue ler bytes
+			fit = dataLen;
 		}
+		if (fit > MAX_DATA_SIZE - headerLen)
+		{
+			fit = MAX_DATA_SIZE - headerLen;
+		}
+		return fit;
+	}
 
-		frame[frame_pos++] = byte; // Armazena o byte lido na posição corrente
+	int cost = 0;
+	unsigned char bcc2 = 0;
+	for (int i = 0; i < headerLen; i++)
+	{
+		cost += stuffedSize(header[i]);
+		bcc2 ^= header[i];
+	}
 
-		// Se FLAG é encontrada (indica o fim da trama)
-		if (byte == FLAG && frame_pos > 1)
+	// Avança byte a byte; o BCC2 (que também pode precisar de stuffing)
+	// é contado exatamente para cada tamanho candidato
+	int fit = -1;
+	for (int n = 0;; n++)
+	{
+		if (cost + stuffedSize(bcc2) <= budget)
 		{
-			done = 1; // Define a flag de término do loop
+			fit = n;
 		}
+		if (n == dataLen || headerLen + n == MAX_DATA_SIZE || cost + 1 > budget)
+		{
+			break;
+		}
+		cost += stuffedSize(data[n]);
+		bcc2 ^= data[n];
 	}
+	return fit;
+}
 
-	// Verifica se o BCC1 (XOR entre A e C_I) é válido
-	if (frame[3] != (frame[1] ^ frame[2]))
+////////////////////////////////////////////////
+// LLWRITE
+////////////////////////////////////////////////
+int llwrite_ctx(ll_ctx *ctx, const unsigned char *buf, int bufSize)
+{
+	if (bufSize < 0 || bufSize > MAX_DATA_SIZE)
 	{
-		printf("Erro BCC1.\n");
-		return -1; // Retorna erro se BCC1 é inválido
+		return -1;
 	}
 
-	received_BCC2 = frame[frame_pos - 2]; // Obtém o BCC2 recebido (penúltimo byte da trama)
+	unsigned char frame[MAX_FRAME_SIZE]; // Define o tamanho da trama (cabeçalho + BCC + dados com stuffing)
+
+	// Define o campo de controle (C_I) e alterna entre os frames 0 e 1
+	// Frame 0 para C_I = 0x00, frame 1 para C_I = 0x80
+	TRACE_BEGIN("llwrite");
+	TRACE_BEGIN("build frame");
+	int totalSize = buildFrame(ctx, ctx->trans_frame == 0 ? C_I : C_II, buf, bufSize, frame);
+	TRACE_END("build frame");
+	int bytes_written = 0;
+
+	int retryCount = 0;	  // Contador de tentativas de reenvio
+	int REJ_received = 0; // Flag para rejeição de trama
+	int attempts = 0;	  // Envios desta trama (o primeiro não é retransmissão)
+	ctx->alarmCount = 0;
+
+	// Configura resposta esperada: RR para ACK e REJ para NACK
+	unsigned char RR = (ctx->trans_frame == 0) ? RR_1 : RR_0;
+	unsigned char response[CONTROL_FRAME_SIZE];
+	unsigned char S_POS[CONTROL_FRAME_SIZE] = {FLAG, A, RR, A ^ RR, FLAG};	  // Resposta RR (ACK)
+	unsigned char S_NEG[CONTROL_FRAME_SIZE] = {FLAG, A, REJ, A ^ REJ, FLAG}; // Resposta REJ (NACK)
 
-	// Processa a trama (fazendo destuffing) e calcula BCC2
-	for (int i = 4; i < frame_pos - 2; i++)
+	// Loop de tentativas de envio com timeout e retransmissão
+	while (retryCount < ctx->maxRetries && ctx->alarmCount < ctx->maxRetries)
 	{
-		// Detecção de escape
-		if (frame[i] == ESC)
+		if (attempts++ > 0)
 		{
-			i++; // Avança para o byte escapado
-			// FLAG escapada
-			if (frame[i] == ESC_FLAG)
+			ctx->retransmissions++;
+			TRACE_INSTANT("retransmit", attempts - 1);
+		}
+		ctx->framesSent++;
+		bytes_written = transportWriteBytes(ctx->transport, frame, totalSize); // Envia a trama
+		TRACE_INSTANT("frame written", bytes_written);
+		alarmStart(ctx); // Define timeout para aguardar resposta
+		REJ_received = 0;
+		TRACE_BEGIN("wait ack");
+
+		// Loop para aguardar RR/REJ
+		while (ctx->alarmEnabled)
+		{
+			int ret = readControlFrame(ctx, response);
+			if (ret < 0)
+			{
+				TRACE_END("wait ack");
+				TRACE_END("llwrite");
+				return -1; // Erro de leitura
+			}
+			if (ret == 0)
 			{
-				packet[buf_pos++] = FLAG; // Copia FLAG para o buffer de dados
-				calculated_BCC2 ^= FLAG;  // Atualiza o cálculo do BCC2
+				break; // Timeout
 			}
-			// ESC escapado
-			else if (frame[i] == ESC_ESC)
+
+			if (memcmp(response, S_POS, sizeof(S_POS)) == 0) // RR recebido
 			{
-				packet[buf_pos++] = ESC; // Copia ESC para o buffer de dados
-				calculated_BCC2 ^= ESC;	 // Atualiza o cálculo do BCC2
+				TRACE_END("wait ack");
+				TRACE_INSTANT("RR parsed", RR);
+				TRACE_END("llwrite");
+				LOG_DEBUG("Recebido RR\n");
+				ctx->trans_frame = (ctx->trans_frame == 0) ? 1 : 0; // Alterna frame
+				alarmStop(ctx);										// Cancela o alarme
+				ctx->alarmCount = 0;
+				LOG_DEBUG("Enviados %d bytes.\n", bytes_written);
+				return bufSize; // Retorna sucesso
 			}
+			else if (memcmp(response, S_NEG, sizeof(S_NEG)) == 0) // REJ recebido
+			{
+				TRACE_INSTANT("REJ parsed", REJ);
+				alarmStop(ctx); // Cancela o alarme
+				REJ_received = 1;
+				ctx->rejReceived++;
+				break; // Encerra loop para retransmitir
+			}
+		}
+
+		TRACE_END("wait ack");
+
+		// Lógica de retransmissão com base em timeout e REJ
+		if (REJ_received == 1)
+		{
+			retryCount++;
+			LOG_DEBUG("REJ recebido. Retransmitir trama. Tentativa %d/%d\n", retryCount, ctx->maxRetries);
 		}
-		else
+		else if (ctx->alarmCount < ctx->maxRetries)
+		{
+			LOG_DEBUG("Timeout. Retransmitir trama.\n");
+		}
+	}
+
+	TRACE_END("llwrite");
+	LOG_ERROR("Máximo de tentativas excedido.\n");
+	return -1; // Falha após o máximo de tentativas
+}
+
+int llwrite(const unsigned char *buf, int bufSize)
+{
+	if (defaultCtx == NULL)
+	{
+		return -1;
+	}
+	return llwrite_ctx(defaultCtx, buf, bufSize);
+}
+
+////////////////////////////////////////////////
+// LLREAD
+////////////////////////////////////////////////
+// Resultados de readFrame para uma trama repetida, confirmada mas não
+// entregue, e para uma sonda já devolvida
+#define DUPLICATE_FRAME -2
+#define PROBE_FRAME -3
+
+// Lê uma trama I para packet e confirma-a (RR) ou rejeita-a (REJ).
+// Retorna o tamanho dos dados, -1 em erro, DUPLICATE_FRAME ou PROBE_FRAME.
+static int readFrame(ll_ctx *ctx, unsigned char *packet)
+{
+	unsigned char frame[MAX_FRAME_SIZE];					  // Buffer para armazenar a trama recebida
+	int buf_pos = 0;										  // Posição no buffer do pacote de dados
+	unsigned char calculated_BCC2 = 0;						  // Valor de BCC2 calculado
+	unsigned char received_BCC2 = 0;						  // Valor de BCC2 recebido
+	unsigned char RR = (ctx->trans_frame == 0) ? RR_1 : RR_0; // Define o valor esperado de RR
+	struct timespec frameEnd;								  // Chegada da FLAG final, para medir a resposta
+
+	int frame_pos = readRawFrame(ctx, frame); // Tamanho da trama no buffer
+	if (frame_pos <= 0)
+	{
+		LOG_DEBUG("Erro ao ler da serial port\n");
+		return -1; // Retorna erro se não consegue ler bytes
+	}
+	clock_gettime(CLOCK_MONOTONIC, &frameEnd);
+	TRACE_INSTANT("frame received", frame_pos);
+
+	// Verifica se o BCC1 (XOR entre A e C_I) é válido
+	if (frame_pos < CONTROL_FRAME_SIZE || frame[3] != (frame[1] ^ frame[2]))
+	{
+		LOG_DEBUG("Erro BCC1.\n");
+		return -1; // Retorna erro se BCC1 é inválido
+	}
+
+	// Sonda do transmissor: devolvida sem a descodificar (os erros também voltam)
+	if (frame[2] == C_PROBE)
+	{
+		frame[2] = C_PROBE_ECHO;
+		frame[3] = frame[1] ^ frame[2];
+		transportWriteBytes(ctx->transport, frame, frame_pos);
+		return PROBE_FRAME;
+	}
+
+	// Trama de controlo: um SET repetido (o UA perdeu-se) volta a ser confirmado
+	if (frame[2] != C_I && frame[2] != C_II)
+	{
+		if (frame[2] == C_SET || frame[2] == C_SET_COBS)
 		{
-			packet[buf_pos++] = frame[i]; // Copia o dado para o buffer de dados
-			calculated_BCC2 ^= frame[i];  // Atualiza o cálculo do BCC2
+			unsigned char C = (ctx->framing == LlFramingCobs) ? C_UA_COBS : C_UA;
+			unsigned char UA[CONTROL_FRAME_SIZE] = {FLAG, A, C, A ^ C, FLAG};
+			transportWriteBytes(ctx->transport, UA, sizeof(UA));
 		}
+		return -1;
+	}
+
+	// Processa a trama (destuffing ou COBS); o último byte obtido é o BCC2
+	unsigned char body[MAX_DATA_SIZE + 1];
+	TRACE_BEGIN("decode frame");
+	int bodyLen = (ctx->framing == LlFramingCobs)
+					  ? cobsDecode(frame + 4, frame_pos - 5, body, sizeof(body))
+					  : destuff(frame + 4, frame_pos - 5, body, sizeof(body));
+	TRACE_END("decode frame");
+	if (bodyLen <= 0)
+	{
+		LOG_DEBUG("Erro BCC2. Trama inválida\n");
+		return -1;
+	}
+
+	// Copia os dados para o pacote e calcula BCC2
+	received_BCC2 = body[bodyLen - 1];
+	for (buf_pos = 0; buf_pos < bodyLen - 1; buf_pos++)
+	{
+		packet[buf_pos] = body[buf_pos];
+		calculated_BCC2 ^= body[buf_pos];
 	}
 
 	// Verifica se o BCC2 calculado corresponde ao BCC2 recebido
 	if (calculated_BCC2 != received_BCC2)
 	{
-		printf("Erro BCC2. Calculado: 0x%02X, Recebido: 0x%02X\n", calculated_BCC2, received_BCC2);
-		unsigned char S_NEG[5] = {FLAG, A, REJ, A ^ REJ, FLAG}; // Mensagem de NACK
+		LOG_DEBUG("Erro BCC2. Calculado: 0x%02X, Recebido: 0x%02X\n", calculated_BCC2, received_BCC2);
+		unsigned char S_NEG[CONTROL_FRAME_SIZE] = {FLAG, A, REJ, A ^ REJ, FLAG}; // Mensagem de NACK
 
-		writeBytesSerialPort(S_NEG, sizeof(S_NEG)); // Envia REJ (NACK)
-		printf("Receptor: REJ enviado \n");
+		transportWriteBytes(ctx->transport, S_NEG, sizeof(S_NEG)); // Envia REJ (NACK)
+		TRACE_INSTANT("REJ sent", REJ);
+		latencyRecord(&ctx->turnaround, &frameEnd);
+		ctx->rejSent++;
+		LOG_DEBUG("Receptor: REJ enviado \n");
 
 		return -1; // Retorna erro se BCC2 é inválido
 	}
+	else if ((frame[2] == C_II) != ctx->trans_frame)
+	{
+		// Trama repetida (o RR anterior perdeu-se): confirma de novo sem a entregar
+		unsigned char RR_AGAIN = (ctx->trans_frame == 0) ? RR_0 : RR_1;
+		unsigned char S_POS[CONTROL_FRAME_SIZE] = {FLAG, A, RR_AGAIN, A ^ RR_AGAIN, FLAG};
+		transportWriteBytes(ctx->transport, S_POS, sizeof(S_POS));
+		TRACE_INSTANT("RR sent (duplicate)", RR_AGAIN);
+		latencyRecord(&ctx->turnaround, &frameEnd);
+		LOG_DEBUG("Receptor: trama repetida, RR reenviado \n");
+		return DUPLICATE_FRAME;
+	}
 	else
 	{
-		unsigned char S_POS[5] = {FLAG, A, RR, A ^ RR, FLAG}; // Mensagem de ACK
-		trans_frame = (trans_frame == 0) ? 1 : 0;			  // Alterna número da trama
-		writeBytesSerialPort(S_POS, sizeof(S_POS));			  // Envia RR (ACK)
-
-		printf("Receptor: RR enviado \n");
+		unsigned char S_POS[CONTROL_FRAME_SIZE] = {FLAG, A, RR, A ^ RR, FLAG}; // Mensagem de ACK
+		ctx->trans_frame = (ctx->trans_frame == 0) ? 1 : 0;					  // Alterna número da trama
+		transportWriteBytes(ctx->transport, S_POS, sizeof(S_POS));			  // Envia RR (ACK)
+		TRACE_INSTANT("RR sent", RR);
+		latencyRecord(&ctx->turnaround, &frameEnd);
+		ctx->framesReceived++;
+
+		LOG_DEBUG("Receptor: RR enviado \n");
 		return buf_pos; // Retorna o tamanho do pacote de dados recebido
 	}
 }
 
+int llread_ctx(ll_ctx *ctx, unsigned char *packet)
+{
+	int ret;
+	do
+	{
+		ret = readFrame(ctx, packet);
+	} while (ret == DUPLICATE_FRAME || ret == PROBE_FRAME);
+	return ret;
+}
+
+int llread(unsigned char *packet)
+{
+	if (defaultCtx == NULL)
+	{
+		return -1;
+	}
+	return llread_ctx(defaultCtx, packet);
+}
+
+// Imprime as estatísticas da ligação
+static void printStatistics(const ll_ctx *ctx)
+{
+	logFlush(); // As mensagens da ligação saem antes das estatísticas
+	printf("Estatísticas da ligação:\n");
+	if (ctx->role == LlTx)
+	{
+		printf("  Tramas I enviadas: %d\n", ctx->framesSent);
+		printf("  Retransmissões: %d\n", ctx->retransmissions);
+		printf("  Timeouts: %d\n", ctx->timeouts);
+		printf("  REJ recebidos: %d\n", ctx->rejReceived);
+	}
+	else
+	{
+		printf("  Tramas I recebidas: %d\n", ctx->framesReceived);
+		printf("  REJ enviados: %d\n", ctx->rejSent);
+		latencyPrint(&ctx->turnaround, "Tempo de resposta");
+	}
+}
+
 ////////////////////////////////////////////////
 // LLCLOSE
 ////////////////////////////////////////////////
-int llclose(int showStatistics)
+int llclose_ctx(ll_ctx *ctx, int showStatistics)
 {
+	unsigned char response[CONTROL_FRAME_SIZE] = {0}; // Armazena a resposta recebida
+	int done = 0;
+
 	// Lógica do Transmissor (tx)
-	if (role == 0)
+	if (ctx->role == LlTx)
 	{
 		// Inicializa tramas DISC e UA, e a resposta DISC esperada
 		unsigned char DISC[CONTROL_FRAME_SIZE] = {FLAG, A, C_DISC, A ^ C_DISC, FLAG};
 		unsigned char UA[CONTROL_FRAME_SIZE] = {FLAG, A_Rx, C_UA, A_Rx ^ C_UA, FLAG};
 		unsigned char DISC_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A_Rx, C_DISC, A_Rx ^ C_DISC, FLAG};
 
-		unsigned char response[CONTROL_FRAME_SIZE] = {0}; // Armazena a resposta recebida
-
-		State state = WAITING_FOR_FLAG; // Estado inicial da máquina de estados
-
-		int index = 0;
-		int done = 0;
 		int retries = 0;
 
-		alarmEnabled = FALSE;
-		alarmCount = 0;
-
-		// Configura o handler do alarme
-		struct sigaction act = {0};
-		act.sa_handler = &alarmHandler;
-		// sigemptyset(&act.sa_mask);
-		////act.sa_flags = 0;
-
-		if (sigaction(SIGALRM, &act, NULL) == -1)
-		{
-			perror("sigaction");
-			exit(EXIT_FAILURE);
-		}
-		//(void)signal(SIGALRM, alarmHandler);
+		ctx->alarmEnabled = FALSE;
+		ctx->alarmCount = 0;
 
 		// Loop de envio e espera de resposta DISC
-		while (!done && retries < MAX_RETRIES)
+		while (!done && retries < ctx->maxRetries)
 		{
-			if (!alarmEnabled)
+			if (!ctx->alarmEnabled)
 			{
-				printf("Transmissor: Enviando DISC.\n");
-				writeBytesSerialPort(DISC, sizeof(DISC)); // Envia trama DISC
-				alarm(TIMEOUT);							  // Ativa alarme com timeout
-				alarmEnabled = TRUE;
+				LOG_INFO("Transmissor: Enviando DISC.\n");
+				transportWriteBytes(ctx->transport, DISC, sizeof(DISC)); // Envia trama DISC
+				alarmStart(ctx);										 // Ativa alarme com timeout
 				retries++;
-				state = WAITING_FOR_FLAG;
-				index = 0;
 			}
 
-			unsigned char byte;
-			int bytesRead = readByteSerialPort(&byte);
+			int ret = readControlFrame(ctx, response);
 
 			// Verifica timeout ou erro de leitura
-			if (bytesRead <= 0)
+			if (ret < 0)
 			{
-				if (errno == EINTR)
-				{
-					printf("Timeout. Reenviar DISC \n");
-					continue;
-				}
-				else
-				{
-					return -1; // Erro de leitura
-				}
+				break; // Erro de leitura
+			}
+			if (ret == 0)
+			{
+				LOG_WARN("Timeout. Reenviar DISC \n");
+				continue;
 			}
 
-			// Máquina de estados para processar a resposta DISC
-			if (bytesRead > 0)
+			// Confirma recebimento de DISC
+			if (memcmp(response, DISC_EXPECTED, CONTROL_FRAME_SIZE) == 0)
 			{
-				switch (state)
-				{
-				case WAITING_FOR_FLAG:
-					if (byte == FLAG)
-					{
-
-						response[index++] = byte;
-						state = READING;
-					}
-					break;
-				case READING:
-					response[index++] = byte;
-					if (index == CONTROL_FRAME_SIZE && byte == FLAG)
-					{
-						// Confirma recebimento de DISC
-						if (memcmp(response, DISC_EXPECTED, CONTROL_FRAME_SIZE) == 0)
-						{
-							printf("Transmissor: Recebido DISC\n");
-							done = 1;
-						}
-						index = 0;
-						state = WAITING_FOR_FLAG;
-					}
-					break;
-				default:
-					break;
-				}
+				LOG_INFO("Transmissor: Recebido DISC\n");
+				done = 1;
 			}
 		}
-		if (!done)
-		{
-			return -1; // Se falha em receber DISC
-		}
 
-		alarm(0); // Desativa alarme
-		alarmEnabled = FALSE;
+		alarmStop(ctx); // Desativa alarme
 
 		// Envia UA para finalizar conexão
-		if (!alarmEnabled)
+		if (done)
 		{
-			printf("Transmissor: Enviando UA.\n");
-			writeBytesSerialPort(UA, sizeof(UA)); // Enviar trama UA
+			LOG_INFO("Transmissor: Enviando UA.\n");
+			transportWriteBytes(ctx->transport, UA, sizeof(UA)); // Enviar trama UA
 		}
-
-		return 1;
 	}
 	// Lógica do Receptor (rx)
-	else if (role == 1)
+	else if (ctx->role == LlRx)
 	{
 		// Inicializa tramas DISC e as respostas esperadas DISC e UA
 		unsigned char DISC[CONTROL_FRAME_SIZE] = {FLAG, A_Rx, C_DISC, A_Rx ^ C_DISC, FLAG};
 		unsigned char DISC_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A, C_DISC, A ^ C_DISC, FLAG};
 		unsigned char UA_EXPECTED[CONTROL_FRAME_SIZE] = {FLAG, A_Rx, C_UA, A_Rx ^ C_UA, FLAG};
 
-		unsigned char response[CONTROL_FRAME_SIZE] = {0};  // Armazena a resposta DISC recebida
-		unsigned char response2[CONTROL_FRAME_SIZE] = {0}; // Armazena a resposta UA recebida
-
-		State state = WAITING_FOR_FLAG; // Estado inicial da máquina de estados
-
-		int index = 0;
-		int done = 0;
-
 		// Loop para esperar e processar o DISC do transmissor
-		while (!done)
+		while (!done && readControlFrame(ctx, response) > 0)
 		{
-			unsigned char byte;
-			if (readByteSerialPort(&byte) <= 0)
-			{
-				continue; // Continua tentando até receber um byte
-			}
-
-			// Processa o byte de acordo com o estado da leitura
-			switch (state)
+			// Confirma recebimento de DISC
+			if (memcmp(response, DISC_EXPECTED, CONTROL_FRAME_SIZE) == 0)
 			{
-			case WAITING_FOR_FLAG:
-				if (byte == FLAG)
-				{
-					response[index++] = byte;
-					state = READING;
-				}
-				break;
-			case READING:
-				response[index++] = byte;
-				if (index == CONTROL_FRAME_SIZE && byte == FLAG)
-				{
-					// Confirma recebimento de DISC
-					if (memcmp(response, DISC_EXPECTED, CONTROL_FRAME_SIZE) == 0)
-					{
-						printf("Receptor: Recebido DISC\n");
-						done = 1;
-					}
-					index = 0;
-					state = WAITING_FOR_FLAG;
-				}
-				break;
-			default:
-				break;
+				LOG_INFO("Receptor: Recebido DISC\n");
+				done = 1;
 			}
 		}
 
-		printf("Receptor: Enviando DISC.\n");
-		writeBytesSerialPort(DISC, sizeof(DISC)); // Envia DISC em resposta ao DISC do transmissor
-
-		// Reinicia variáveis para esperar o UA do transmissor
-		done = 0;
-		index = 0;
-		state = WAITING_FOR_FLAG;
-
-		// Loop para esperar e processar o UA do transmissor
-		while (!done)
+		if (done)
 		{
-			unsigned char byte;
-			if (readByteSerialPort(&byte) <= 0)
-			{
-				continue; // Continua tentando até receber um byte
-			}
+			LOG_INFO("Receptor: Enviando DISC.\n");
+			transportWriteBytes(ctx->transport, DISC, sizeof(DISC)); // Envia DISC em resposta ao DISC do transmissor
 
-			// Processa o byte de acordo com o estado da leitura
-			switch (state)
+			// Loop para esperar e processar o UA do transmissor
+			done = 0;
+			while (!done && readControlFrame(ctx, response) > 0)
 			{
-			case WAITING_FOR_FLAG:
-				if (byte == FLAG)
-				{
-					response2[index++] = byte;
-					state = READING;
-				}
-				break;
-			case READING:
-				response2[index++] = byte;
-				if (index == CONTROL_FRAME_SIZE && byte == FLAG)
+				// Confirma recebimento de UA
+				if (memcmp(response, UA_EXPECTED, CONTROL_FRAME_SIZE) == 0)
 				{
-					// Confirma recebimento de UA
-					if (memcmp(response2, UA_EXPECTED, CONTROL_FRAME_SIZE) == 0)
-					{
-						printf("Receptor: Recebido UA\n");
-						done = 1; // Conexão estabelecida
-					}
-					index = 0;
-					state = WAITING_FOR_FLAG;
+					LOG_INFO("Receptor: Recebido UA\n");
+					done = 1; // Conexão terminada
 				}
-				break;
-			default:
-				break;
 			}
 		}
-		return 1;
 	}
-	return -1; // Retorna erro se papel desconhecido
+
+	if (showStatistics)
+	{
+		printStatistics(ctx);
+	}
+
+	transportClose(ctx->transport); // Liberta o canal
+	free(ctx);
+	return done ? 1 : -1;
+}
+
+int llclose(int showStatistics)
+{
+	if (defaultCtx == NULL)
+	{
+		return -1;
+	}
+	int ret = llclose_ctx(defaultCtx, showStatistics);
+	defaultCtx = NULL;
+	return ret;
 }
@@ -0,0 +1,236 @@
+#include "link_layer_agg.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Prefixo de cada mensagem no lote: tamanho em 2 bytes (big endian)
+#define RECORD_HEADER_SIZE 2
+
+struct ll_agg
+{
+	ll_ctx *ctx;
+	int maxDelayMs;
+	pthread_t flusher;
+	pthread_mutex_t lock;	   // Protege o lote e os campos abaixo
+	pthread_mutex_t writeLock; // Mantém a ordem dos lotes enviados
+	pthread_cond_t queued;	   // Há mensagens no lote ou pedido de paragem
+
+	// Lote em construção
+	unsigned char batch[MAX_PAYLOAD_SIZE + RECORD_HEADER_SIZE]; // Com espaço para testar o prefixo seguinte
+	int batchLen;
+	struct timespec deadline; // Envio do lote o mais tardar neste instante
+
+	int error; // Um envio falhou: a ligação já não é fiável
+	int frames; // Tramas enviadas ou recebidas
+	int stop;
+
+	// Receptor: trama atual e posição da próxima mensagem
+	unsigned char frame[MAX_PAYLOAD_SIZE];
+	int frameLen;
+	int framePos;
+};
+
+// Envia o lote atual. Tem de ser chamada sem o lock.
+static int flush(ll_agg *agg)
+{
+	unsigned char frame[MAX_PAYLOAD_SIZE];
+
+	pthread_mutex_lock(&agg->writeLock);
+	pthread_mutex_lock(&agg->lock);
+	int len = agg->batchLen;
+	memcpy(frame, agg->batch, len);
+	agg->batchLen = 0; // As próximas mensagens já vão para o lote seguinte
+	int ret = agg->error ? -1 : 0;
+	pthread_mutex_unlock(&agg->lock);
+
+	if (len > 0 && ret == 0 && llwrite_ctx(agg->ctx, frame, len) < 0)
+	{
+		pthread_mutex_lock(&agg->lock);
+		agg->error = 1;
+		pthread_mutex_unlock(&agg->lock);
+		ret = -1;
+	}
+	else if (len > 0 && ret == 0)
+	{
+		pthread_mutex_lock(&agg->lock);
+		agg->frames++;
+		pthread_mutex_unlock(&agg->lock);
+	}
+	pthread_mutex_unlock(&agg->writeLock);
+	return ret;
+}
+
+// Envia os lotes incompletos quando a mensagem mais antiga chega ao prazo
+static void *flusher(void *arg)
+{
+	ll_agg *agg = arg;
+
+	pthread_mutex_lock(&agg->lock);
+	while (!agg->stop)
+	{
+		if (agg->batchLen == 0)
+		{
+			pthread_cond_wait(&agg->queued, &agg->lock);
+			continue;
+		}
+		struct timespec deadline = agg->deadline;
+		if (pthread_cond_timedwait(&agg->queued, &agg->lock, &deadline) == ETIMEDOUT && agg->batchLen > 0)
+		{
+			// O lote pode ter mudado entretanto; só é enviado se o prazo for o mesmo
+			if (agg->deadline.tv_sec == deadline.tv_sec && agg->deadline.tv_nsec == deadline.tv_nsec)
+			{
+				pthread_mutex_unlock(&agg->lock);
+				flush(agg);
+				pthread_mutex_lock(&agg->lock);
+			}
+		}
+	}
+	pthread_mutex_unlock(&agg->lock);
+	return NULL;
+}
+
+ll_agg *ll_agg_create(ll_ctx *ctx, int maxDelayMs)
+{
+	ll_agg *agg = calloc(1, sizeof(ll_agg));
+	if (agg == NULL)
+	{
+		return NULL;
+	}
+	agg->ctx = ctx;
+	agg->maxDelayMs = maxDelayMs;
+	pthread_mutex_init(&agg->lock, NULL);
+	pthread_mutex_init(&agg->writeLock, NULL);
+
+	// O prazo é medido no relógio monotónico, como o temporizador da ligação
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&agg->queued, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&agg->flusher, NULL, flusher, agg) != 0)
+	{
+		pthread_mutex_destroy(&agg->lock);
+		pthread_mutex_destroy(&agg->writeLock);
+		pthread_cond_destroy(&agg->queued);
+		free(agg);
+		return NULL;
+	}
+	return agg;
+}
+
+int ll_agg_send(ll_agg *agg, const unsigned char *msg, int size)
+{
+	if (size < 0 || size > LL_AGG_MAX_MESSAGE)
+	{
+		return -1;
+	}
+
+	unsigned char header[RECORD_HEADER_SIZE] = {size / 256, size % 256};
+
+	pthread_mutex_lock(&agg->lock);
+	while (!agg->error)
+	{
+		// Cabe se o lote com o prefixo e a mensagem completa couber na trama
+		int len = agg->batchLen;
+		memcpy(agg->batch + len, header, RECORD_HEADER_SIZE);
+		if (len + RECORD_HEADER_SIZE + size <= MAX_PAYLOAD_SIZE &&
+			llfit_ctx(agg->ctx, agg->batch, len + RECORD_HEADER_SIZE, msg, size) >= size)
+		{
+			break;
+		}
+		if (len == 0)
+		{
+			pthread_mutex_unlock(&agg->lock);
+			return -1; // Nem sozinha cabe numa trama
+		}
+
+		// Lote cheio: envia-o e volta a tentar no seguinte
+		pthread_mutex_unlock(&agg->lock);
+		flush(agg);
+		pthread_mutex_lock(&agg->lock);
+	}
+	if (agg->error)
+	{
+		pthread_mutex_unlock(&agg->lock);
+		return -1;
+	}
+
+	if (agg->batchLen == 0)
+	{
+		// Primeira mensagem do lote: marca o prazo e acorda o flusher
+		clock_gettime(CLOCK_MONOTONIC, &agg->deadline);
+		agg->deadline.tv_sec += agg->maxDelayMs / 1000;
+		agg->deadline.tv_nsec += (agg->maxDelayMs % 1000) * 1000000L;
+		if (agg->deadline.tv_nsec >= 1000000000L)
+		{
+			agg->deadline.tv_sec++;
+			agg->deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_signal(&agg->queued);
+	}
+	memcpy(agg->batch + agg->batchLen + RECORD_HEADER_SIZE, msg, size);
+	agg->batchLen += RECORD_HEADER_SIZE + size;
+	pthread_mutex_unlock(&agg->lock);
+	return 0;
+}
+
+int ll_agg_flush(ll_agg *agg)
+{
+	return flush(agg);
+}
+
+int ll_agg_recv(ll_agg *agg, unsigned char *msg)
+{
+	// Trama esgotada: lê a próxima
+	while (agg->framePos + RECORD_HEADER_SIZE > agg->frameLen)
+	{
+		agg->frameLen = llread_ctx(agg->ctx, agg->frame);
+		agg->framePos = 0;
+		if (agg->frameLen <= 0 && llbroken_ctx(agg->ctx))
+		{
+			agg->frameLen = 0;
+			return -1;
+		}
+		if (agg->frameLen > 0)
+		{
+			agg->frames++;
+		}
+	}
+
+	int size = agg->frame[agg->framePos] * 256 + agg->frame[agg->framePos + 1];
+	agg->framePos += RECORD_HEADER_SIZE;
+	if (agg->framePos + size > agg->frameLen)
+	{
+		size = agg->frameLen - agg->framePos; // Registo truncado: entrega o que houver
+	}
+	memcpy(msg, agg->frame + agg->framePos, size);
+	agg->framePos += size;
+	return size;
+}
+
+int ll_agg_frames(ll_agg *agg)
+{
+	pthread_mutex_lock(&agg->lock);
+	int frames = agg->frames;
+	pthread_mutex_unlock(&agg->lock);
+	return frames;
+}
+
+void ll_agg_destroy(ll_agg *agg)
+{
+	flush(agg);
+
+	pthread_mutex_lock(&agg->lock);
+	agg->stop = 1;
+	pthread_cond_signal(&agg->queued);
+	pthread_mutex_unlock(&agg->lock);
+
+	pthread_join(agg->flusher, NULL);
+	pthread_mutex_destroy(&agg->lock);
+	pthread_mutex_destroy(&agg->writeLock);
+	pthread_cond_destroy(&agg->queued);
+	free(agg);
+}
@@ -0,0 +1,220 @@
+#include "link_layer_async.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Operação submetida e ainda não executada
+typedef struct
+{
+	LlAsyncOp op;
+	unsigned char data[MAX_PAYLOAD_SIZE]; // Cópia dos dados a enviar
+	int size;
+	unsigned char *packet; // Destino da leitura
+	LlCallback cb;
+	void *user;
+} Request;
+
+struct ll_async
+{
+	ll_ctx *ctx;
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t submitted; // Há pedidos para o worker
+	pthread_cond_t drained;	  // Todos os pedidos foram executados
+
+	// Fila circular de pedidos
+	Request requests[LL_ASYNC_QUEUE_SIZE];
+	int reqHead;
+	int reqCount;
+	int busy; // O worker está a executar um pedido
+
+	// Fila circular de conclusões à espera de ll_async_poll
+	LlCompletion completions[LL_ASYNC_QUEUE_SIZE];
+	int compHead;
+	int compCount;
+
+	int efd; // Sinaliza conclusões pendentes
+	int stop;
+	int writeFailed; // Uma escrita falhou: as seguintes já não são enviadas
+};
+
+// Número de operações que ocupam lugar: pedidos, o que está em curso e conclusões por recolher
+static int outstanding(const ll_async *a)
+{
+	return a->reqCount + a->busy + a->compCount;
+}
+
+static void *worker(void *arg)
+{
+	ll_async *a = arg;
+
+	pthread_mutex_lock(&a->lock);
+	while (1)
+	{
+		while (a->reqCount == 0 && !a->stop)
+		{
+			pthread_cond_wait(&a->submitted, &a->lock);
+		}
+		if (a->reqCount == 0)
+		{
+			break; // Pedido de paragem e nada mais a fazer
+		}
+
+		// Retira o pedido da fila; a execução é feita sem o lock
+		Request *req = &a->requests[a->reqHead];
+		a->reqHead = (a->reqHead + 1) % LL_ASYNC_QUEUE_SIZE;
+		a->reqCount--;
+		a->busy = 1;
+		pthread_mutex_unlock(&a->lock);
+
+		LlCompletion c = {.op = req->op, .user = req->user};
+		if (req->op == LlAsyncWrite)
+		{
+			c.result = a->writeFailed ? -1 : llwrite_ctx(a->ctx, req->data, req->size);
+			a->writeFailed = c.result < 0;
+		}
+		else
+		{
+			c.packet = req->packet;
+			c.result = llread_ctx(a->ctx, req->packet);
+		}
+
+		if (req->cb != NULL)
+		{
+			req->cb(&c);
+		}
+
+		pthread_mutex_lock(&a->lock);
+		a->busy = 0;
+		if (req->cb == NULL)
+		{
+			a->completions[(a->compHead + a->compCount) % LL_ASYNC_QUEUE_SIZE] = c;
+			a->compCount++;
+			uint64_t one = 1;
+			write(a->efd, &one, sizeof(one));
+		}
+		if (a->reqCount == 0)
+		{
+			pthread_cond_broadcast(&a->drained);
+		}
+	}
+	pthread_mutex_unlock(&a->lock);
+	return NULL;
+}
+
+ll_async *ll_async_create(ll_ctx *ctx)
+{
+	ll_async *a = calloc(1, sizeof(ll_async));
+	if (a == NULL)
+	{
+		return NULL;
+	}
+	a->ctx = ctx;
+	a->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (a->efd < 0)
+	{
+		free(a);
+		return NULL;
+	}
+	pthread_mutex_init(&a->lock, NULL);
+	pthread_cond_init(&a->submitted, NULL);
+	pthread_cond_init(&a->drained, NULL);
+
+	if (pthread_create(&a->worker, NULL, worker, a) != 0)
+	{
+		close(a->efd);
+		free(a);
+		return NULL;
+	}
+	return a;
+}
+
+// Coloca um pedido na fila; retorna -1 se estiver cheia
+static int submit(ll_async *a, LlAsyncOp op, const unsigned char *buf, int size, unsigned char *packet, LlCallback cb, void *user)
+{
+	pthread_mutex_lock(&a->lock);
+	if (a->stop || outstanding(a) == LL_ASYNC_QUEUE_SIZE)
+	{
+		pthread_mutex_unlock(&a->lock);
+		return -1;
+	}
+
+	Request *req = &a->requests[(a->reqHead + a->reqCount) % LL_ASYNC_QUEUE_SIZE];
+	req->op = op;
+	req->size = size;
+	if (buf != NULL)
+	{
+		memcpy(req->data, buf, size);
+	}
+	req->packet = packet;
+	req->cb = cb;
+	req->user = user;
+	a->reqCount++;
+
+	pthread_cond_signal(&a->submitted);
+	pthread_mutex_unlock(&a->lock);
+	return 0;
+}
+
+int ll_async_write(ll_async *a, const unsigned char *buf, int bufSize, LlCallback cb, void *user)
+{
+	if (bufSize < 0 || bufSize > MAX_PAYLOAD_SIZE)
+	{
+		return -1;
+	}
+	return submit(a, LlAsyncWrite, buf, bufSize, NULL, cb, user);
+}
+
+int ll_async_read(ll_async *a, unsigned char *packet, LlCallback cb, void *user)
+{
+	return submit(a, LlAsyncRead, NULL, 0, packet, cb, user);
+}
+
+int ll_async_eventfd(const ll_async *a)
+{
+	return a->efd;
+}
+
+int ll_async_poll(ll_async *a, LlCompletion *out, int max)
+{
+	int n = 0;
+	pthread_mutex_lock(&a->lock);
+	while (n < max && a->compCount > 0)
+	{
+		out[n++] = a->completions[a->compHead];
+		a->compHead = (a->compHead + 1) % LL_ASYNC_QUEUE_SIZE;
+		a->compCount--;
+	}
+	// Repõe o eventfd a zero; volta a ser sinalizado se ainda houver conclusões
+	uint64_t count;
+	read(a->efd, &count, sizeof(count));
+	if (a->compCount > 0)
+	{
+		uint64_t one = 1;
+		write(a->efd, &one, sizeof(one));
+	}
+	pthread_mutex_unlock(&a->lock);
+	return n;
+}
+
+void ll_async_destroy(ll_async *a)
+{
+	pthread_mutex_lock(&a->lock);
+	while (a->reqCount > 0 || a->busy)
+	{
+		pthread_cond_wait(&a->drained, &a->lock);
+	}
+	a->stop = 1;
+	pthread_cond_signal(&a->submitted);
+	pthread_mutex_unlock(&a->lock);
+
+	pthread_join(a->worker, NULL);
+	close(a->efd);
+	pthread_mutex_destroy(&a->lock);
+	pthread_cond_destroy(&a->submitted);
+	pthread_cond_destroy(&a->drained);
+	free(a);
+}
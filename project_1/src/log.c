@@ -0,0 +1,247 @@
+#define _GNU_SOURCE // pthread_attr_setaffinity_np
+
+#include "log.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Posição do anel (fila limitada de Vyukov): seq indica se está livre ou
+// preenchida para a volta atual
+typedef struct
+{
+	atomic_size_t seq;
+	char text[LOG_LINE_SIZE];
+} Slot;
+
+int logLevel = LOG_LEVEL_INFO;
+
+static Slot ring[LOG_RING_SIZE];
+static atomic_size_t enqueuePos;
+static atomic_size_t written; // Mensagens já escritas no stderr
+static atomic_ulong dropped;
+static atomic_int stop;
+static atomic_int sleeping; // O escritor está (ou vai ficar) à espera de mensagens
+static int running;         // O escritor arrancou; senão escreve-se diretamente
+static size_t dequeuePos;   // Só usado pelo escritor
+static pthread_t writer;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;  // Há mensagens no anel
+static pthread_cond_t drained = PTHREAD_COND_INITIALIZER; // Mensagens escritas (logFlush)
+
+// Escreve tudo o que estiver no anel; retorna o número de mensagens
+static int drain(void)
+{
+	int n = 0;
+	while (1)
+	{
+		Slot *slot = &ring[dequeuePos & (LOG_RING_SIZE - 1)];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != dequeuePos + 1)
+		{
+			break; // Vazio (ou o produtor ainda está a escrever)
+		}
+		fputs(slot->text, stderr);
+		atomic_store_explicit(&slot->seq, dequeuePos + LOG_RING_SIZE, memory_order_release);
+		dequeuePos++;
+		n++;
+	}
+	if (n > 0)
+	{
+		fflush(stderr);
+		atomic_fetch_add(&written, n);
+	}
+	return n;
+}
+
+// Há uma mensagem pronta na próxima posição a escrever
+static int pending(void)
+{
+	Slot *slot = &ring[dequeuePos & (LOG_RING_SIZE - 1)];
+	return atomic_load_explicit(&slot->seq, memory_order_acquire) == dequeuePos + 1;
+}
+
+// Dorme até haver mensagens: anuncia que vai dormir e volta a ver o anel, para
+// não perder a mensagem de um produtor que não viu o anúncio
+static void *writerThread(void *arg)
+{
+	(void)arg;
+	while (!atomic_load(&stop))
+	{
+		if (drain() > 0)
+		{
+			pthread_mutex_lock(&lock);
+			pthread_cond_broadcast(&drained);
+			pthread_mutex_unlock(&lock);
+			continue;
+		}
+		pthread_mutex_lock(&lock);
+		atomic_store(&sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		while (!pending() && !atomic_load(&stop))
+		{
+			pthread_cond_wait(&queued, &lock);
+		}
+		atomic_store(&sleeping, 0);
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+// Acorda o escritor se estiver à espera (só então se toca no mutex)
+static void wakeWriter(void)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&sleeping))
+	{
+		pthread_mutex_lock(&lock);
+		pthread_cond_signal(&queued);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+// Cria o escritor fora do tempo real: SCHED_OTHER e em qualquer CPU, mesmo
+// que o processo já tenha passado a SCHED_FIFO e fixado um CPU (rtSetup)
+static int startWriter(void)
+{
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	struct sched_param sp = {.sched_priority = 0};
+	pthread_attr_setschedparam(&attr, &sp);
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	long n = sysconf(_SC_NPROCESSORS_CONF);
+	for (long i = 0; i < n && i < CPU_SETSIZE; i++)
+	{
+		CPU_SET(i, &cpus);
+	}
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+	int ret = pthread_create(&writer, &attr, writerThread, NULL);
+	pthread_attr_destroy(&attr);
+	return ret;
+}
+
+// No fim do processo: pára o escritor e escreve o que falta
+static void logShutdown(void)
+{
+	atomic_store(&stop, 1);
+	pthread_mutex_lock(&lock);
+	pthread_cond_broadcast(&queued);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, NULL);
+	drain();
+	unsigned long lost = atomic_load(&dropped);
+	if (lost > 0)
+	{
+		fprintf(stderr, "(%lu mensagens de log perdidas)\n", lost);
+		fflush(stderr);
+	}
+}
+
+// Corre antes do main: o nível de LL_LOG vale desde a primeira mensagem
+__attribute__((constructor)) static void logSetup(void)
+{
+	for (size_t i = 0; i < LOG_RING_SIZE; i++)
+	{
+		atomic_init(&ring[i].seq, i);
+	}
+
+	const char *level = getenv("LL_LOG");
+	if (level != NULL)
+	{
+		const char *names[] = {"error", "warn", "info", "debug"};
+		for (int i = 0; i < 4; i++)
+		{
+			if (strcmp(level, names[i]) == 0)
+			{
+				logLevel = i;
+			}
+		}
+	}
+}
+
+// O escritor só arranca com a primeira mensagem
+static void logInit(void)
+{
+	if (startWriter() == 0)
+	{
+		running = 1;
+		atexit(logShutdown);
+	}
+}
+
+void logWrite(int level, const char *format, ...)
+{
+	(void)level;
+	pthread_once(&once, logInit);
+
+	va_list args;
+	if (!running)
+	{
+		// Sem escritor: escreve já, como um printf
+		char text[LOG_LINE_SIZE];
+		va_start(args, format);
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		fputs(text, stderr);
+		fflush(stderr);
+		return;
+	}
+
+	// Reserva uma posição livre sem bloquear; com o anel cheio a mensagem perde-se
+	size_t pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+	Slot *slot;
+	while (1)
+	{
+		slot = &ring[pos & (LOG_RING_SIZE - 1)];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		long diff = (long)(seq - pos);
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			atomic_fetch_add(&dropped, 1);
+			return;
+		}
+		else
+		{
+			pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+		}
+	}
+
+	va_start(args, format);
+	vsnprintf(slot->text, LOG_LINE_SIZE, format, args);
+	va_end(args);
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	wakeWriter();
+}
+
+void logFlush(void)
+{
+	pthread_once(&once, logInit);
+	if (!running)
+	{
+		return; // Tudo foi escrito diretamente
+	}
+
+	size_t target = atomic_load(&enqueuePos);
+	pthread_mutex_lock(&lock);
+	while (atomic_load(&written) < target && !atomic_load(&stop))
+	{
+		pthread_cond_wait(&drained, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
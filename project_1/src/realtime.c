@@ -0,0 +1,120 @@
+#define _GNU_SOURCE // sched_setaffinity
+
+#include "realtime.h"
+#include "link_layer.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Pilha tocada antes de bloquear a memória, para não haver page faults depois
+#define PREFAULT_STACK_SIZE (256 * 1024)
+
+static void prefaultStack(void)
+{
+	volatile unsigned char stack[PREFAULT_STACK_SIZE];
+	memset((unsigned char *)stack, 0, sizeof(stack));
+}
+
+int rtSetup(void)
+{
+	const char *rt = getenv("LL_RT");
+	if (rt == NULL || strcmp(rt, "0") == 0)
+	{
+		return FALSE;
+	}
+
+	// Memória atual e futura fica residente; a pilha é tocada uma vez
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+	{
+		perror("Could not lock memory");
+	}
+	prefaultStack();
+
+	const char *cpu = getenv("LL_RT_CPU");
+	if (cpu != NULL)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(atoi(cpu), &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		{
+			perror("Could not set CPU affinity");
+		}
+	}
+
+	const char *prio = getenv("LL_RT_PRIO");
+	struct sched_param sp = {.sched_priority = prio != NULL ? atoi(prio) : 50};
+	if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1)
+	{
+		perror("Could not set realtime priority");
+	}
+
+	printf("Modo de tempo real ativo (prioridade %d%s%s).\n", sp.sched_priority,
+		   cpu != NULL ? ", CPU " : "", cpu != NULL ? cpu : "");
+	return TRUE;
+}
+
+// Índice do bucket de v microssegundos
+static int bucketOf(unsigned v)
+{
+	if (v < 64)
+	{
+		return v;
+	}
+	int e = 31 - __builtin_clz(v); // e >= 6
+	return 64 + (e - 6) * 32 + ((v >> (e - 5)) & 31);
+}
+
+// Menor valor (em microssegundos) que cai no bucket b
+static unsigned bucketFloor(int b)
+{
+	if (b < 64)
+	{
+		return b;
+	}
+	int e = (b - 64) / 32 + 6;
+	return (1u << e) | ((unsigned)((b - 64) % 32) << (e - 5));
+}
+
+void latencyRecord(LatencyHist *h, const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long us = (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+	unsigned v = (us < 0) ? 0 : (us > 0x7FFFFFFF ? 0x7FFFFFFF : (unsigned)us);
+
+	h->counts[bucketOf(v)]++;
+	h->n++;
+	if (v > h->maxUs)
+	{
+		h->maxUs = v;
+	}
+}
+
+// Valor abaixo do qual fica a fração q das amostras (limite inferior do bucket)
+static unsigned percentile(const LatencyHist *h, double q)
+{
+	unsigned rank = (unsigned)(q * h->n);
+	unsigned seen = 0;
+	for (int b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		seen += h->counts[b];
+		if (seen > rank)
+		{
+			return bucketFloor(b);
+		}
+	}
+	return h->maxUs;
+}
+
+void latencyPrint(const LatencyHist *h, const char *label)
+{
+	if (h->n == 0)
+	{
+		return;
+	}
+	printf("  %s (us, %u amostras): p50 %u, p90 %u, p99 %u, p99.9 %u, máx %u\n", label, h->n,
+		   percentile(h, 0.50), percentile(h, 0.90), percentile(h, 0.99), percentile(h, 0.999), h->maxUs);
+}
@@ -0,0 +1,140 @@
+#include "sha256.h"
+#include <string.h>
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Processa um bloco de 64 bytes
+static void transform(Sha256 *sha, const unsigned char *block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+			   ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+	}
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3];
+	uint32_t e = sha->state[4], f = sha->state[5], g = sha->state[6], h = sha->state[7];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + S1 + ch + K[i] + w[i];
+		uint32_t S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	sha->state[0] += a;
+	sha->state[1] += b;
+	sha->state[2] += c;
+	sha->state[3] += d;
+	sha->state[4] += e;
+	sha->state[5] += f;
+	sha->state[6] += g;
+	sha->state[7] += h;
+}
+
+void sha256Init(Sha256 *sha)
+{
+	static const uint32_t H0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memcpy(sha->state, H0, sizeof(H0));
+	sha->length = 0;
+	sha->blockLen = 0;
+}
+
+void sha256Update(Sha256 *sha, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	sha->length += len;
+
+	// Completa o bloco parcial
+	if (sha->blockLen > 0)
+	{
+		size_t n = 64 - sha->blockLen;
+		if (n > len)
+		{
+			n = len;
+		}
+		memcpy(sha->block + sha->blockLen, p, n);
+		sha->blockLen += n;
+		p += n;
+		len -= n;
+		if (sha->blockLen < 64)
+		{
+			return;
+		}
+		transform(sha, sha->block);
+		sha->blockLen = 0;
+	}
+
+	// Blocos completos diretamente da entrada
+	while (len >= 64)
+	{
+		transform(sha, p);
+		p += 64;
+		len -= 64;
+	}
+
+	memcpy(sha->block, p, len);
+	sha->blockLen = len;
+}
+
+void sha256Final(Sha256 *sha, unsigned char out[SHA256_SIZE])
+{
+	uint64_t bits = sha->length * 8;
+
+	// Padding: 0x80, zeros e o comprimento em bits (big endian)
+	static const unsigned char pad[64] = {0x80};
+	size_t padLen = (sha->blockLen < 56) ? 56 - sha->blockLen : 120 - sha->blockLen;
+	sha256Update(sha, pad, padLen);
+
+	unsigned char lenBytes[8];
+	for (int i = 0; i < 8; i++)
+	{
+		lenBytes[i] = bits >> (56 - 8 * i);
+	}
+	sha256Update(sha, lenBytes, sizeof(lenBytes));
+
+	for (int i = 0; i < 8; i++)
+	{
+		out[4 * i] = sha->state[i] >> 24;
+		out[4 * i + 1] = sha->state[i] >> 16;
+		out[4 * i + 2] = sha->state[i] >> 8;
+		out[4 * i + 3] = sha->state[i];
+	}
+}
+
+void sha256(const void *data, size_t len, unsigned char out[SHA256_SIZE])
+{
+	Sha256 sha;
+	sha256Init(&sha);
+	sha256Update(&sha, data, len);
+	sha256Final(&sha, out);
+}
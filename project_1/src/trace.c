@@ -0,0 +1,104 @@
+#define _GNU_SOURCE // syscall(SYS_gettid)
+
+#include "trace.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+{
+	const char *name;
+	long long ts; // Microssegundos (CLOCK_REALTIME, comum aos dois lados)
+	long arg;
+	int tid;
+	char phase;
+} TraceEvent;
+
+int traceEnabled = 0;
+
+static TraceEvent ring[TRACE_RING_SIZE];
+static atomic_ulong head;
+static const char *tracePath;
+static char processLabel[32];
+
+static __thread int threadId;
+
+void traceEvent(const char *name, char phase, long arg)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (threadId == 0)
+	{
+		threadId = syscall(SYS_gettid);
+	}
+
+	TraceEvent *e = &ring[atomic_fetch_add(&head, 1) % TRACE_RING_SIZE];
+	e->name = name;
+	e->ts = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+	e->arg = arg;
+	e->tid = threadId;
+	e->phase = phase;
+}
+
+// Escreve os eventos no ficheiro, acrescentando-os aos que lá estiverem
+static void traceDump(void)
+{
+	int fd = open(tracePath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+	{
+		perror("LL_TRACE");
+		return;
+	}
+	FILE *out = fdopen(fd, "a");
+	if (out == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	// O outro lado pode estar a escrever no mesmo ficheiro
+	flock(fd, LOCK_EX);
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size == 0)
+	{
+		fprintf(out, "[\n"); // Formato de array; o "]" final é opcional
+	}
+
+	int pid = getpid();
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n", pid, processLabel);
+
+	unsigned long end = atomic_load(&head);
+	unsigned long start = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+	for (unsigned long i = start; i < end; i++)
+	{
+		const TraceEvent *e = &ring[i % TRACE_RING_SIZE];
+		fprintf(out, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d", e->name, e->phase, e->ts, pid, e->tid);
+		if (e->phase == 'i')
+		{
+			fprintf(out, ",\"s\":\"t\",\"args\":{\"v\":%ld}", e->arg);
+		}
+		fprintf(out, "},\n");
+	}
+	fflush(out);
+	flock(fd, LOCK_UN);
+	fclose(out);
+}
+
+void traceInit(const char *processName)
+{
+	tracePath = getenv("LL_TRACE");
+	if (tracePath == NULL || tracePath[0] == '\0' || traceEnabled)
+	{
+		return;
+	}
+	snprintf(processLabel, sizeof(processLabel), "%s", processName);
+	traceEnabled = 1;
+	atexit(traceDump);
+}
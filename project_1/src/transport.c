@@ -0,0 +1,498 @@
+#include "transport.h"
+#include "serial_port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Definições da porta série guardadas por serial_port.c
+extern struct termios oldtio;
+
+// Tamanho do buffer de receção (um datagrama UDP cabe inteiro)
+#define RX_BUF_SIZE 65536
+
+// Número de tentativas de ligação do transmissor a um socket UNIX (a cada 100 ms)
+#define CONNECT_RETRIES 100
+
+// Backends registados pelo programa (transportRegister)
+#define MAX_BACKENDS 4
+#define BACKEND_PREFIX_SIZE 16
+
+// Tipos de transporte suportados
+typedef enum
+{
+	TRANSPORT_SERIAL,
+	TRANSPORT_UNIX,
+	TRANSPORT_FIFO,
+	TRANSPORT_UDP,
+	TRANSPORT_FD,
+	TRANSPORT_BACKEND
+} TransportType;
+
+struct Transport
+{
+	TransportType type;
+	int rfd; // Descritor de leitura
+	int wfd; // Descritor de escrita (igual a rfd exceto no FIFO)
+
+	// Buffer de receção: evita um read() por byte e guarda o resto de um datagrama
+	unsigned char rxBuf[RX_BUF_SIZE];
+	int rxLen;
+	int rxPos;
+
+	// Definições originais da porta série (uma cópia por instância)
+	struct termios oldtio;
+
+	// Endereço do par UDP (o receptor só o conhece após o primeiro datagrama)
+	struct sockaddr_storage peer;
+	socklen_t peerLen;
+
+	// Backend registado e a extremidade aberta nele
+	const TransportBackend *backend;
+	void *handle;
+};
+
+static struct
+{
+	char prefix[BACKEND_PREFIX_SIZE];
+	const TransportBackend *backend;
+} backends[MAX_BACKENDS];
+static int nBackends;
+static pthread_mutex_t backendsLock = PTHREAD_MUTEX_INITIALIZER;
+
+int transportRegister(const char *prefix, const TransportBackend *backend)
+{
+	if (strlen(prefix) >= BACKEND_PREFIX_SIZE)
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&backendsLock);
+	int ret = -1;
+	if (nBackends < MAX_BACKENDS)
+	{
+		strcpy(backends[nBackends].prefix, prefix);
+		backends[nBackends].backend = backend;
+		nBackends++;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&backendsLock);
+	return ret;
+}
+
+// Backend registado para o prefixo de portName (antes de ':'), ou NULL
+static const TransportBackend *findBackend(const char *portName, const char **name)
+{
+	const TransportBackend *backend = NULL;
+	pthread_mutex_lock(&backendsLock);
+	for (int i = 0; i < nBackends && backend == NULL; i++)
+	{
+		size_t len = strlen(backends[i].prefix);
+		if (strncmp(portName, backends[i].prefix, len) == 0 && portName[len] == ':')
+		{
+			backend = backends[i].backend;
+			*name = portName + len + 1;
+		}
+	}
+	pthread_mutex_unlock(&backendsLock);
+	return backend;
+}
+
+// Separa "host:porta" (a porta é o que vem depois do último ':')
+static int splitHostPort(const char *address, char *host, size_t hostSize, const char **port)
+{
+	const char *colon = strrchr(address, ':');
+	if (colon == NULL || (size_t)(colon - address) >= hostSize)
+	{
+		return -1;
+	}
+	memcpy(host, address, colon - address);
+	host[colon - address] = '\0';
+	*port = colon + 1;
+	return 0;
+}
+
+static int openUnix(Transport *t, const char *path, LinkLayerRole role)
+{
+	struct sockaddr_un addr = {0};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "unix: caminho demasiado longo: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+
+	// Receptor: espera pela ligação do transmissor
+	if (role == LlRx)
+	{
+		unlink(path);
+		if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 1) < 0)
+		{
+			perror(path);
+			close(sock);
+			return -1;
+		}
+		int conn = accept(sock, NULL, NULL);
+		close(sock);
+		unlink(path);
+		if (conn < 0)
+		{
+			perror("accept");
+			return -1;
+		}
+		t->rfd = t->wfd = conn;
+		return 0;
+	}
+
+	// Transmissor: tenta ligar até o receptor estar à escuta
+	for (int i = 0; i < CONNECT_RETRIES; i++)
+	{
+		if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		{
+			t->rfd = t->wfd = sock;
+			return 0;
+		}
+		usleep(100000);
+	}
+	perror(path);
+	close(sock);
+	return -1;
+}
+
+static int openFifo(Transport *t, const char *path, LinkLayerRole role)
+{
+	char tx2rx[256], rx2tx[256];
+	snprintf(tx2rx, sizeof(tx2rx), "%s.tx2rx", path);
+	snprintf(rx2tx, sizeof(rx2tx), "%s.rx2tx", path);
+
+	if ((mkfifo(tx2rx, 0666) < 0 && errno != EEXIST) || (mkfifo(rx2tx, 0666) < 0 && errno != EEXIST))
+	{
+		perror("mkfifo");
+		return -1;
+	}
+
+	// Um FIFO sem leitor gera SIGPIPE; preferimos receber EPIPE
+	signal(SIGPIPE, SIG_IGN);
+
+	// A ordem de abertura é a mesma nos dois lados para evitar deadlock
+	if (role == LlTx)
+	{
+		t->wfd = open(tx2rx, O_WRONLY);
+		t->rfd = open(rx2tx, O_RDONLY);
+	}
+	else
+	{
+		t->rfd = open(tx2rx, O_RDONLY);
+		t->wfd = open(rx2tx, O_WRONLY);
+	}
+	if (t->rfd < 0 || t->wfd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static int openUdp(Transport *t, const char *address, LinkLayerRole role)
+{
+	char host[256];
+	const char *port;
+	if (splitHostPort(address, host, sizeof(host), &port) < 0)
+	{
+		fprintf(stderr, "udp: endereço inválido (esperado host:porta): %s\n", address);
+		return -1;
+	}
+
+	struct addrinfo hints = {0};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo *res;
+	int err = getaddrinfo(host, port, &hints, &res);
+	if (err != 0)
+	{
+		fprintf(stderr, "udp: %s: %s\n", address, gai_strerror(err));
+		return -1;
+	}
+
+	int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock < 0)
+	{
+		perror("socket");
+		freeaddrinfo(res);
+		return -1;
+	}
+
+	// Receptor escuta no endereço; transmissor envia sempre para ele
+	int ret = (role == LlRx) ? bind(sock, res->ai_addr, res->ai_addrlen)
+							 : connect(sock, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (ret < 0)
+	{
+		perror(address);
+		close(sock);
+		return -1;
+	}
+	t->rfd = t->wfd = sock;
+	return 0;
+}
+
+// Abre uma extremidade num backend registado. Não há descritor: a leitura e
+// a escrita passam pelo backend.
+static int openBackend(Transport *t, const char *portName, const char *name, LinkLayerRole role)
+{
+	t->handle = t->backend->open(name, role);
+	if (t->handle == NULL)
+	{
+		fprintf(stderr, "%s: não foi possível abrir\n", portName);
+		return -1;
+	}
+	return 0;
+}
+
+// serial_port.c guarda o estado em variáveis globais; serializa a abertura e
+// copia as definições originais para que cada instância restaure as suas
+static pthread_mutex_t serialLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int openSerial(Transport *t, const char *serialPort, int baudRate)
+{
+	pthread_mutex_lock(&serialLock);
+	int fd = openSerialPort(serialPort, baudRate);
+	if (fd >= 0)
+	{
+		t->oldtio = oldtio;
+	}
+	pthread_mutex_unlock(&serialLock);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	t->rfd = t->wfd = fd;
+	return 0;
+}
+
+Transport *transportOpen(const char *portName, int baudRate, LinkLayerRole role)
+{
+	Transport *t = calloc(1, sizeof(Transport));
+	if (t == NULL)
+	{
+		return NULL;
+	}
+	t->rfd = t->wfd = -1;
+
+	int ret;
+	const char *name;
+	if ((t->backend = findBackend(portName, &name)) != NULL)
+	{
+		t->type = TRANSPORT_BACKEND;
+		ret = openBackend(t, portName, name, role);
+	}
+	else if (strncmp(portName, "unix:", 5) == 0)
+	{
+		t->type = TRANSPORT_UNIX;
+		ret = openUnix(t, portName + 5, role);
+	}
+	else if (strncmp(portName, "fifo:", 5) == 0)
+	{
+		t->type = TRANSPORT_FIFO;
+		ret = openFifo(t, portName + 5, role);
+	}
+	else if (strncmp(portName, "udp:", 4) == 0)
+	{
+		t->type = TRANSPORT_UDP;
+		ret = openUdp(t, portName + 4, role);
+	}
+	else if (strncmp(portName, "fd:", 3) == 0)
+	{
+		t->type = TRANSPORT_FD;
+		t->rfd = t->wfd = atoi(portName + 3);
+		ret = fcntl(t->rfd, F_GETFD) < 0 ? -1 : 0;
+		if (ret < 0)
+		{
+			perror(portName);
+		}
+	}
+	else
+	{
+		t->type = TRANSPORT_SERIAL;
+		ret = openSerial(t, portName, baudRate);
+	}
+
+	if (ret < 0)
+	{
+		if (t->rfd >= 0)
+		{
+			close(t->rfd);
+		}
+		if (t->wfd >= 0 && t->wfd != t->rfd)
+		{
+			close(t->wfd);
+		}
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+int transportClose(Transport *t)
+{
+	if (t == NULL)
+	{
+		return -1;
+	}
+
+	if (t->type == TRANSPORT_BACKEND)
+	{
+		t->backend->close(t->handle);
+		free(t);
+		return 0;
+	}
+
+	int ret = 0;
+	if (t->type == TRANSPORT_SERIAL && tcsetattr(t->rfd, TCSANOW, &t->oldtio) == -1)
+	{
+		perror("tcsetattr");
+		ret = -1;
+	}
+	if (close(t->rfd) < 0)
+	{
+		ret = -1;
+	}
+	if (t->wfd != t->rfd && close(t->wfd) < 0)
+	{
+		ret = -1;
+	}
+	free(t);
+	return ret;
+}
+
+int transportFd(const Transport *t)
+{
+	return t->rfd;
+}
+
+int transportReadByte(Transport *t, unsigned char *byte)
+{
+	return transportReadByteTimeout(t, byte, -1);
+}
+
+int transportReadByteTimeout(Transport *t, unsigned char *byte, int timeoutMs)
+{
+	if (t->rxPos == t->rxLen && t->type == TRANSPORT_BACKEND)
+	{
+		// O backend espera no seu próprio tempo (ex.: virtual)
+		int n = t->backend->read(t->handle, t->rxBuf, sizeof(t->rxBuf), timeoutMs);
+		if (n <= 0)
+		{
+			return n;
+		}
+		t->rxLen = n;
+		t->rxPos = 0;
+	}
+	else if (t->rxPos == t->rxLen)
+	{
+		int n = 0;
+		while (n == 0)
+		{
+			// Espera por dados sem bloquear para lá do prazo
+			if (timeoutMs >= 0)
+			{
+				struct pollfd pfd = {.fd = t->rfd, .events = POLLIN};
+				int ready = poll(&pfd, 1, timeoutMs);
+				if (ready < 0 && errno != EINTR)
+				{
+					return -1;
+				}
+				if (ready <= 0)
+				{
+					return 0;
+				}
+			}
+
+			if (t->type != TRANSPORT_UDP)
+			{
+				n = read(t->rfd, t->rxBuf, sizeof(t->rxBuf));
+				if (n <= 0)
+				{
+					return -1; // Erro ou canal fechado pelo outro lado
+				}
+				break;
+			}
+
+			struct sockaddr_storage from;
+			socklen_t fromLen = sizeof(from);
+			n = recvfrom(t->rfd, t->rxBuf, sizeof(t->rxBuf), 0, (struct sockaddr *)&from, &fromLen);
+			if (n < 0)
+			{
+				return -1;
+			}
+			// O receptor fica com o primeiro par que lhe escreve e ignora os
+			// outros; os datagramas vazios não trazem bytes
+			if (t->peerLen > 0 && (fromLen != t->peerLen || memcmp(&from, &t->peer, fromLen) != 0))
+			{
+				n = 0;
+			}
+			else if (n > 0)
+			{
+				t->peer = from;
+				t->peerLen = fromLen;
+			}
+			if (n == 0 && timeoutMs >= 0)
+			{
+				return 0; // Quem chamou volta a esperar com o prazo que resta
+			}
+		}
+		t->rxLen = n;
+		t->rxPos = 0;
+	}
+	*byte = t->rxBuf[t->rxPos++];
+	return 1;
+}
+
+int transportWriteBytes(Transport *t, const unsigned char *bytes, int numBytes)
+{
+	switch (t->type)
+	{
+	case TRANSPORT_UDP:
+		// O receptor responde para quem lhe enviou o último datagrama
+		if (t->peerLen > 0)
+		{
+			return sendto(t->wfd, bytes, numBytes, 0, (struct sockaddr *)&t->peer, t->peerLen);
+		}
+		return send(t->wfd, bytes, numBytes, 0);
+	case TRANSPORT_UNIX:
+		return send(t->wfd, bytes, numBytes, MSG_NOSIGNAL);
+	case TRANSPORT_BACKEND:
+		return t->backend->write(t->handle, bytes, numBytes);
+	default:
+		return write(t->wfd, bytes, numBytes);
+	}
+}
+
+void transportNow(const Transport *t, struct timespec *now)
+{
+	if (t->type == TRANSPORT_BACKEND)
+	{
+		t->backend->now(t->handle, now);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, now);
+}